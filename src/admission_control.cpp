@@ -0,0 +1,152 @@
+#include "admission_control.h"
+
+#include <progdn_core/ip_address_helper.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace progdn
+{
+    const size_t AdmissionControl::kProbesNumber;
+    const size_t AdmissionControl::kShardsNumber;
+
+    AdmissionControl::AdmissionControl(const Limits& limits, size_t capacity) :
+        m_limits(limits),
+        m_shards(new Shard[kShardsNumber])
+    {
+        size_t slots_number = kProbesNumber;
+        while (slots_number * kShardsNumber < capacity)
+            slots_number *= 2;
+        m_slot_mask = slots_number - 1;
+        for (size_t i = 0; i < kShardsNumber; ++i)
+            m_shards[i].entries.assign(slots_number, Entry{});
+    }
+
+    AdmissionControl::Verdict AdmissionControl::admit(const boost::asio::ip::address& source, Ticket& ticket) noexcept
+    {
+        auto key = make_key(source);
+        auto verdict = count(key);
+        if (verdict == Verdict::Admitted)
+            ticket = Ticket(*this, key);
+        return verdict;
+    }
+
+    AdmissionControl::Verdict AdmissionControl::count(const Key& key) noexcept
+    {
+        auto key_hash = hash(key);
+        auto& shard = m_shards[key_hash % kShardsNumber];
+        auto home_slot = static_cast<size_t>(key_hash / kShardsNumber);
+        auto now = Clock::now().time_since_epoch().count();
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Entry* entry = nullptr;
+        Entry* free_entry = nullptr;
+        for (size_t i = 0; i < kProbesNumber; ++i) {
+            auto& slot = shard.entries[(home_slot + i) & m_slot_mask];
+            if (slot.updated != 0 && slot.key == key) {
+                entry = &slot;
+                break;
+            }
+            if (!free_entry && (slot.updated == 0 || is_expired(slot, now)))
+                free_entry = &slot;
+            // Source is never placed after a slot, which was never used
+            if (slot.updated == 0)
+                break;
+        }
+        if (!entry) {
+            if (!free_entry)
+                return Verdict::Untracked;
+            entry = free_entry;
+            *entry = Entry{ key, 0, static_cast<float>(m_limits.connect_burst), now };
+        }
+
+        if (m_limits.max_connections > 0 && entry->connections >= m_limits.max_connections)
+            return Verdict::TooManyConnections;
+        if (m_limits.connect_rate > 0) {
+            refill(*entry, now);
+            if (entry->tokens < 1)
+                return Verdict::RateLimited;
+            entry->tokens -= 1;
+        }
+        ++entry->connections;
+        return Verdict::Admitted;
+    }
+
+    const char* AdmissionControl::to_string(Verdict verdict) noexcept
+    {
+        switch (verdict)
+        {
+        case Verdict::Admitted:
+            return "Admitted";
+        case Verdict::TooManyConnections:
+            return "Too many connections from the source";
+        case Verdict::RateLimited:
+            return "Connect rate of the source is exceeded";
+        case Verdict::Untracked:
+            return "Source is not tracked";
+        default:
+            return "???";
+        };
+    }
+
+    AdmissionControl::Key AdmissionControl::make_key(const boost::asio::ip::address& source) noexcept
+    {
+        // IPv4 is keyed as IPv4-mapped IPv6 address, IPv6 - by prefix /64. Mapped addresses (from TCP6 headers)
+        // are keyed as IPv4, since all of them have the same prefix.
+        if (source.is_v4())
+            return Key{ 0, 0xffff00000000ull | IP_Host(source.to_v4()).host };
+        auto source_v6 = source.to_v6();
+        if (source_v6.is_v4_mapped())
+            return make_key(boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, source_v6));
+        auto bytes = source_v6.to_bytes();
+        uint64_t prefix;
+        std::memcpy(&prefix, bytes.data(), sizeof(prefix));
+        return Key{ prefix, 0 };
+    }
+
+    uint64_t AdmissionControl::hash(const Key& key) noexcept
+    {
+        // Finalizer of SplitMix64
+        auto value = key.high * 0x9e3779b97f4a7c15ull ^ key.low;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+
+    bool AdmissionControl::is_expired(const Entry& entry, Clock::rep now) const noexcept
+    {
+        if (entry.connections > 0)
+            return false;
+        if (m_limits.connect_rate <= 0)
+            return true;
+        // Bucket would be full by now
+        auto elapsed = std::chrono::duration<double>(Clock::duration(now - entry.updated)).count();
+        return (entry.tokens + elapsed * m_limits.connect_rate >= m_limits.connect_burst);
+    }
+
+    void AdmissionControl::refill(Entry& entry, Clock::rep now) const noexcept
+    {
+        auto elapsed = std::chrono::duration<double>(Clock::duration(now - entry.updated)).count();
+        entry.tokens = static_cast<float>(
+            std::min(entry.tokens + elapsed * m_limits.connect_rate, m_limits.connect_burst));
+        entry.updated = now;
+    }
+
+    void AdmissionControl::release(const Key& key) noexcept
+    {
+        auto key_hash = hash(key);
+        auto& shard = m_shards[key_hash % kShardsNumber];
+        auto home_slot = static_cast<size_t>(key_hash / kShardsNumber);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        // Entry with connections is not expired, so it is not reused by other source
+        for (size_t i = 0; i < kProbesNumber; ++i) {
+            auto& slot = shard.entries[(home_slot + i) & m_slot_mask];
+            if (slot.updated != 0 && slot.key == key) {
+                if (slot.connections > 0)
+                    --slot.connections;
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <boost/asio/ip/address.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace progdn
+{
+    // Limits of concurrent connections and of connect rate (token bucket) per source IP from PROXY header.
+    // IPv6 sources are limited by /64 prefix (a single visitor usually has the whole prefix).
+    //
+    // State of sources is kept in a fixed-size open-addressing hash table split into shards with own mutexes, so
+    // threads rarely contend. Entries are never deleted: entry of a source without connections and with full bucket
+    // is expired and is reused by another source (lazily, on insertion).
+    class AdmissionControl : public boost::noncopyable
+    {
+    public:
+        struct Limits {
+            // Concurrent connections (0 - unlimited)
+            uint32_t max_connections;
+            // Connections per second (0 - unlimited) and size of bucket
+            double connect_rate;
+            double connect_burst;
+        };
+
+        enum class Verdict {
+            Admitted,
+            TooManyConnections,
+            RateLimited,
+            // Table is full around the slot of the source, so the source is not limited
+            Untracked
+        };
+
+        struct Key {
+            uint64_t high;
+            uint64_t low;
+
+            bool operator==(const Key& other) const noexcept {
+                return (high == other.high && low == other.low);
+            }
+        };
+
+        // Connection counted in the table; it is released on destruction
+        class Ticket : public boost::noncopyable
+        {
+        private:
+            AdmissionControl* m_owner = nullptr;
+            Key m_key = {};
+
+        public:
+            Ticket() = default;
+            Ticket(AdmissionControl& owner, const Key& key) : m_owner(&owner), m_key(key) {}
+
+            Ticket(Ticket&& other) noexcept : m_owner(other.m_owner), m_key(other.m_key) {
+                other.m_owner = nullptr;
+            }
+
+            Ticket& operator=(Ticket&& other) noexcept {
+                if (this != &other) {
+                    release();
+                    m_owner = other.m_owner;
+                    m_key = other.m_key;
+                    other.m_owner = nullptr;
+                }
+                return *this;
+            }
+
+            ~Ticket() {
+                release();
+            }
+
+        private:
+            void release() noexcept {
+                if (m_owner) {
+                    m_owner->release(m_key);
+                    m_owner = nullptr;
+                }
+            }
+        };
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Entry {
+            Key key;
+            uint32_t connections;
+            float tokens;
+            // Time of the last refill of tokens (zero - entry was never used)
+            Clock::rep updated;
+        };
+
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::vector<Entry> entries;
+        };
+
+    private:
+        // Source is looked up only within this number of slots after its home slot
+        static const size_t kProbesNumber = 16;
+        static const size_t kShardsNumber = 64;
+
+        const Limits m_limits;
+        std::unique_ptr<Shard[]> m_shards;
+        size_t m_slot_mask;
+
+    public:
+        // "capacity" - number of sources tracked at once (rounded up to power of 2)
+        AdmissionControl(const Limits& limits, size_t capacity);
+
+    public:
+        // Counts connection from "source" (in the ticket), if it is admitted
+        Verdict admit(const boost::asio::ip::address& source, Ticket& ticket) noexcept;
+
+        static const char* to_string(Verdict verdict) noexcept;
+
+    private:
+        static Key make_key(const boost::asio::ip::address& source) noexcept;
+        Verdict count(const Key& key) noexcept;
+        static uint64_t hash(const Key& key) noexcept;
+        bool is_expired(const Entry& entry, Clock::rep now) const noexcept;
+        void refill(Entry& entry, Clock::rep now) const noexcept;
+        void release(const Key& key) noexcept;
+    };
+}
@@ -0,0 +1,149 @@
+// Microbenchmark of PROXY protocol header parser: measures time per header for valid, truncated and garbage inputs.
+// Exits with non-zero code, if parser returns unexpected status for any input or admission control shares limits
+// of different IPv4-mapped sources.
+
+#include "admission_control.h"
+#include "haproxy_protocol.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using namespace progdn;
+
+    struct Case {
+        const char* name;
+        std::string input;
+        haproxy_protocol::ParseStatus expected_status;
+    };
+
+    std::string make_v2(uint8_t family_protocol, const std::string& addresses, uint8_t version_command = 0x21) {
+        std::string result(haproxy_protocol::v2::kSignature, haproxy_protocol::v2::kSignatureSize);
+        result += static_cast<char>(version_command);
+        result += static_cast<char>(family_protocol);
+        result += static_cast<char>(addresses.size() >> 8);
+        result += static_cast<char>(addresses.size() & 0xFF);
+        return result + addresses;
+    }
+
+    std::vector<Case> make_cases() {
+        using haproxy_protocol::ParseStatus;
+        const std::string payload = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+        const std::string v1_tcp4 = "PROXY TCP4 192.168.100.200 10.0.0.1 56324 443\r\n";
+        const std::string v1_tcp6 = "PROXY TCP6 2001:db8::ff00:42:8329 2001:db8::1 56324 443\r\n";
+        const std::string v2_tcp4 = make_v2(0x11, std::string("\xC0\xA8\x64\xC8\x0A\x00\x00\x01\xDC\x04\x01\xBB", 12));
+        const std::string v2_tcp6 = make_v2(0x21, std::string(32, '\x20') + std::string("\xDC\x04\x01\xBB", 4));
+        // Health check of the proxy: address block is ignored
+        const std::string v2_local = make_v2(0x00, std::string(), 0x20);
+        std::string garbage(64, '\0');
+        for (size_t i = 0; i < garbage.size(); ++i)
+            garbage[i] = static_cast<char>((i * 131 + 7) & 0xFF);
+
+        return {
+            { "v1/tcp4/valid",              v1_tcp4 + payload,                       ParseStatus::Complete },
+            { "v1/tcp6/valid",              v1_tcp6 + payload,                       ParseStatus::Complete },
+            { "v1/tcp4/truncated",          v1_tcp4.substr(0, v1_tcp4.size() - 5),   ParseStatus::Incomplete },
+            { "v1/tcp4/bad_port",           "PROXY TCP4 192.168.100.200 10.0.0.1 99999 443\r\n", ParseStatus::Invalid },
+            { "v1/unknown",                 "PROXY UNKNOWN\r\n",                     ParseStatus::Invalid },
+            { "v1/overlong_field",          "PROXY TCP4 " + std::string(200, '1'),   ParseStatus::Invalid },
+            { "v2/tcp4/valid",              v2_tcp4 + payload,                       ParseStatus::Complete },
+            { "v2/tcp6/valid",              v2_tcp6 + payload,                       ParseStatus::Complete },
+            { "v2/local/valid",             v2_local,                                ParseStatus::Complete },
+            { "v2/tcp4/truncated",          v2_tcp4.substr(0, 20),                   ParseStatus::Incomplete },
+            { "garbage/http",               payload,                                 ParseStatus::Invalid },
+            { "garbage/binary",             garbage,                                 ParseStatus::Invalid },
+        };
+    }
+
+    const char* describe(const haproxy_protocol::ParseResult& result) {
+        switch (result.status)
+        {
+        case haproxy_protocol::ParseStatus::Complete:
+            return "Complete";
+        case haproxy_protocol::ParseStatus::Incomplete:
+            return "Incomplete";
+        default:
+            return haproxy_protocol::to_string(result.error);
+        }
+    }
+
+    // IPv4-mapped sources of TCP6 headers are limited separately, like IPv4 sources (their /64 prefixes are equal)
+    bool are_mapped_sources_separate() {
+        const std::string headers[] = {
+            "PROXY TCP6 ::ffff:192.0.2.1 2001:db8::1 56324 443\r\n",
+            "PROXY TCP6 ::ffff:192.0.2.2 2001:db8::1 56324 443\r\n"
+        };
+        AdmissionControl admission_control(AdmissionControl::Limits{ 1, 0, 0 }, 1024);
+        AdmissionControl::Ticket tickets[2];
+        for (size_t i = 0; i < 2; ++i) {
+            haproxy_protocol::Header header;
+            auto result = haproxy_protocol::parse(headers[i].data(), headers[i].size(), header);
+            if (result.status != haproxy_protocol::ParseStatus::Complete
+                || admission_control.admit(header.src_ip, tickets[i]) != AdmissionControl::Verdict::Admitted)
+                return false;
+        }
+        // The same source as IPv4 address shares the limit
+        AdmissionControl::Ticket ticket;
+        auto source = boost::asio::ip::make_address("192.0.2.1");
+        return admission_control.admit(source, ticket) == AdmissionControl::Verdict::TooManyConnections;
+    }
+
+    // Returns nanoseconds per header
+    double run(const Case& test_case, std::chrono::nanoseconds min_time, size_t& iterations) {
+        using Clock = std::chrono::steady_clock;
+        volatile size_t sink = 0;
+        auto data = test_case.input.data();
+        auto size = test_case.input.size();
+        haproxy_protocol::Header header;
+        // Number of iterations grows until measurement takes enough time
+        for (iterations = 1000;; iterations *= 4) {
+            auto begin = Clock::now();
+            for (size_t i = 0; i < iterations; ++i) {
+                auto result = haproxy_protocol::parse(data, size, header);
+                sink = sink + result.header_size + static_cast<size_t>(result.error);
+            }
+            auto elapsed = Clock::now() - begin;
+            if (elapsed >= min_time)
+                return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // Usage: progdn-rvi-header-bench [<minimal time per case, ms>]
+    std::chrono::milliseconds min_time(500);
+    if (argc > 1)
+        min_time = std::chrono::milliseconds(boost::lexical_cast<unsigned>(argv[1]));
+
+    int exit_code = 0;
+    std::printf("%-24s %12s %14s  %s\n", "Benchmark", "Time", "Iterations", "Result");
+    std::printf("%s\n", std::string(70, '-').c_str());
+    for (const auto& test_case : make_cases()) {
+        haproxy_protocol::Header header;
+        auto result = haproxy_protocol::parse(test_case.input.data(), test_case.input.size(), header);
+        auto is_expected = (result.status == test_case.expected_status);
+        if (!is_expected)
+            exit_code = 1;
+
+        size_t iterations = 0;
+        auto ns_per_header = run(test_case, min_time, iterations);
+        std::printf("%-24s %9.1f ns %14zu  %s%s\n",
+                    test_case.name, ns_per_header, iterations,
+                    describe(result),
+                    is_expected ? "" : " (UNEXPECTED STATUS)");
+    }
+
+    auto is_separate = are_mapped_sources_separate();
+    if (!is_separate)
+        exit_code = 1;
+    std::printf("%-24s %12s %14s  %s\n", "admission/v4_mapped", "-", "-",
+                is_separate ? "Separate" : "Shared (UNEXPECTED)");
+    return exit_code;
+}
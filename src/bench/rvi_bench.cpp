@@ -0,0 +1,365 @@
+// Load generator for progdn-rvi: opens client connections to its listener, sends PROXY v1 headers and requests,
+// and receives responses from a destination server (bundled echo server by default). Reports connections per second,
+// throughput and latency percentiles of connect, first byte of response and whole transfer.
+//
+// Example (progdn-rvi is started with "transparent = false", "listen = 127.0.0.1:2222"):
+//   progdn-rvi-bench --target 127.0.0.1:2222 --backend-port 8080 --connections 100000 --concurrency 256
+//
+// Bundled destination server does not accept TCP Fast Open, unless "--backend-fast-open" is specified, so with
+// "tcp_fastopen_connect = true" both paths of progdn-rvi are measured: SYN alone (no cookie) and SYN with payload.
+
+#include <progdn_core/awaitable.h>
+
+#include <netinet/tcp.h>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using boost::asio::ip::tcp;
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        tcp::endpoint target;
+        // Destination port in PROXY header (bundled backend listens on it, unless disabled)
+        uint16_t backend_port = 8080;
+        bool is_backend_bundled = true;
+        // Bundled backend accepts TCP Fast Open
+        bool is_backend_fast_open = false;
+        unsigned threads = 1;
+        size_t connections = 10000;
+        size_t concurrency = 64;
+        size_t request_size = 128;
+        size_t response_size = 1024;
+        // Source addresses in PROXY headers: "source_ips" consecutive addresses starting from "source_ip",
+        // ports are taken in turn from the range
+        boost::asio::ip::address_v4 source_ip = boost::asio::ip::address_v4::from_string("127.0.0.2");
+        unsigned source_ips = 1;
+        uint16_t source_port_min = 10000;
+        uint16_t source_port_max = 60000;
+    };
+
+    // Latencies of a thread, microseconds
+    struct Results {
+        std::vector<double> connect;
+        std::vector<double> first_byte;
+        std::vector<double> transfer;
+        size_t errors = 0;
+        uint64_t bytes = 0;
+
+        void merge(const Results& other) {
+            connect.insert(connect.end(), other.connect.begin(), other.connect.end());
+            first_byte.insert(first_byte.end(), other.first_byte.begin(), other.first_byte.end());
+            transfer.insert(transfer.end(), other.transfer.begin(), other.transfer.end());
+            errors += other.errors;
+            bytes += other.bytes;
+        }
+    };
+
+    double elapsed_us(Clock::time_point since) {
+        return std::chrono::duration<double, std::micro>(Clock::now() - since).count();
+    }
+
+    tcp::endpoint parse_endpoint(const std::string& str) {
+        auto colon = str.rfind(':');
+        if (colon == std::string::npos)
+            throw std::runtime_error("'" + str + "' is not an IP/port string");
+        return tcp::endpoint(boost::asio::ip::address::from_string(str.substr(0, colon)),
+                             boost::lexical_cast<uint16_t>(str.substr(colon + 1)));
+    }
+
+    // Destination server: reads request and replies with response of configured size
+    class Backend : public std::enable_shared_from_this<Backend>
+    {
+    private:
+        const Options& m_options;
+        boost::asio::io_context& m_io_context;
+        tcp::acceptor m_acceptor;
+
+    public:
+        Backend(const Options& options, boost::asio::io_context& io_context) :
+            m_options(options), m_io_context(io_context), m_acceptor(io_context) {}
+
+        void start() {
+            tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), m_options.backend_port);
+            m_acceptor.open(endpoint.protocol());
+            m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+            // Each thread has own acceptor
+            int reuse_port = 1;
+            ::setsockopt(m_acceptor.native_handle(), SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port));
+            m_acceptor.bind(endpoint);
+            if (m_options.is_backend_fast_open) {
+                int queue_length = 4096;
+                ::setsockopt(m_acceptor.native_handle(), IPPROTO_TCP, TCP_FASTOPEN, &queue_length, sizeof(queue_length));
+            }
+            m_acceptor.listen(4096);
+            boost::asio::co_spawn(m_io_context, accept(shared_from_this()), boost::asio::detached);
+        }
+
+        void stop() {
+            boost::system::error_code error;
+            m_acceptor.close(error);
+        }
+
+    private:
+        static progdn::Awaitable<> accept(std::shared_ptr<Backend> self) {
+            while (true) {
+                tcp::socket sock(self->m_io_context);
+                boost::system::error_code error;
+                co_await self->m_acceptor.async_accept(sock, progdn::with_error(error));
+                if (error == boost::asio::error::operation_aborted)
+                    co_return;
+                if (error)
+                    continue;
+                boost::asio::co_spawn(self->m_io_context, serve(self, std::move(sock)), boost::asio::detached);
+            }
+        }
+
+        static progdn::Awaitable<> serve(std::shared_ptr<Backend> self, tcp::socket sock) {
+            const auto& options = self->m_options;
+            std::vector<char> buffer(std::max(options.request_size, options.response_size));
+            boost::system::error_code error;
+            co_await boost::asio::async_read(
+                sock, boost::asio::buffer(buffer.data(), options.request_size), progdn::with_error(error));
+            if (error)
+                co_return;
+            co_await boost::asio::async_write(
+                sock, boost::asio::buffer(buffer.data(), options.response_size), progdn::with_error(error));
+            sock.shutdown(tcp::socket::shutdown_send, error);
+            // Wait for client to close connection, so TIME_WAIT stays on the client's side
+            char byte;
+            co_await sock.async_read_some(boost::asio::buffer(&byte, 1), progdn::with_error(error));
+        }
+    };
+
+    // Clients of a thread share the counter of connections with other threads
+    class Worker
+    {
+    private:
+        const Options& m_options;
+        boost::asio::io_context& m_io_context;
+        std::atomic<size_t>& m_next_connection;
+        // Called, when a client has no more connections to make
+        std::function<void()> m_on_client_finished;
+        Results m_results;
+
+    public:
+        Worker(
+            const Options& options,
+            boost::asio::io_context& io_context,
+            std::atomic<size_t>& next_connection,
+            std::function<void()> on_client_finished) :
+            m_options(options),
+            m_io_context(io_context),
+            m_next_connection(next_connection),
+            m_on_client_finished(std::move(on_client_finished)) {}
+
+        void start(size_t clients) {
+            for (size_t i = 0; i < clients; ++i) {
+                boost::asio::co_spawn(m_io_context, run(), boost::asio::detached);
+            }
+        }
+
+        const Results& results() const noexcept {
+            return m_results;
+        }
+
+    private:
+        std::string make_header(size_t index) const {
+            auto source_ip = boost::asio::ip::address_v4(
+                m_options.source_ip.to_ulong() + static_cast<uint32_t>(index % m_options.source_ips));
+            auto ports = static_cast<size_t>(m_options.source_port_max - m_options.source_port_min) + 1;
+            auto source_port = m_options.source_port_min + (index / m_options.source_ips) % ports;
+            return "PROXY TCP4 " + source_ip.to_string() + " 127.0.0.1 " + std::to_string(source_port) + ' '
+                + std::to_string(m_options.backend_port) + "\r\n";
+        }
+
+        // Worker outlives its io_context, so clients refer to it by pointer
+        progdn::Awaitable<> run() {
+            std::string request;
+            std::vector<char> response(m_options.response_size);
+            while (true) {
+                auto index = m_next_connection.fetch_add(1, std::memory_order_relaxed);
+                if (index >= m_options.connections) {
+                    m_on_client_finished();
+                    co_return;
+                }
+
+                auto start_time = Clock::now();
+                tcp::socket sock(m_io_context);
+                boost::system::error_code error;
+                co_await sock.async_connect(m_options.target, progdn::with_error(error));
+                if (error) {
+                    ++m_results.errors;
+                    continue;
+                }
+                m_results.connect.push_back(elapsed_us(start_time));
+                sock.set_option(tcp::no_delay(true), error);
+
+                request = make_header(index);
+                request.append(m_options.request_size, 'x');
+                auto request_time = Clock::now();
+                co_await boost::asio::async_write(sock, boost::asio::buffer(request), progdn::with_error(error));
+                if (!error && m_options.response_size > 0) {
+                    auto bytes = co_await sock.async_read_some(boost::asio::buffer(response), progdn::with_error(error));
+                    if (!error) {
+                        m_results.first_byte.push_back(elapsed_us(request_time));
+                        co_await boost::asio::async_read(
+                            sock, boost::asio::buffer(&response[bytes], response.size() - bytes),
+                            progdn::with_error(error));
+                    }
+                }
+                if (error) {
+                    ++m_results.errors;
+                    continue;
+                }
+                m_results.transfer.push_back(elapsed_us(start_time));
+                m_results.bytes += m_options.request_size + m_options.response_size;
+            }
+        }
+    };
+
+    double percentile(const std::vector<double>& sorted, double fraction) {
+        if (sorted.empty())
+            return 0;
+        auto index = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+        return sorted[std::min(std::max<size_t>(index, 1), sorted.size()) - 1];
+    }
+
+    void print_latency(const char* name, std::vector<double>& values) {
+        std::sort(values.begin(), values.end());
+        std::printf("%-12s %10.1f %10.1f %10.1f %10.1f\n", name,
+                    percentile(values, 0.5), percentile(values, 0.99), percentile(values, 0.999),
+                    values.empty() ? 0.0 : values.back());
+    }
+
+    Options parse_options(int argc, char** argv) {
+        namespace po = boost::program_options;
+        Options options;
+        std::string target = "127.0.0.1:2222";
+        std::string source_ip = options.source_ip.to_string();
+        std::string source_ports = std::to_string(options.source_port_min) + '-' + std::to_string(options.source_port_max);
+        po::options_description description("progdn-rvi load generator\n\nAllowed options");
+        description.add_options()
+            ("help", "Produce help message and exit")
+            ("target", po::value(&target)->default_value(target), "Listening address of progdn-rvi")
+            ("backend-port", po::value(&options.backend_port)->default_value(options.backend_port),
+             "Destination port in PROXY headers")
+            ("no-backend", "Do not run bundled destination server (use external one)")
+            ("backend-fast-open", "Bundled destination server accepts TCP Fast Open")
+            ("threads", po::value(&options.threads)->default_value(options.threads), "Number of event loops")
+            ("connections", po::value(&options.connections)->default_value(options.connections),
+             "Total number of connections")
+            ("concurrency", po::value(&options.concurrency)->default_value(options.concurrency),
+             "Number of simultaneous connections")
+            ("request-size", po::value(&options.request_size)->default_value(options.request_size),
+             "Bytes sent by client after PROXY header")
+            ("response-size", po::value(&options.response_size)->default_value(options.response_size),
+             "Bytes sent by destination server")
+            ("source-ip", po::value(&source_ip)->default_value(source_ip), "First source IP in PROXY headers")
+            ("source-ips", po::value(&options.source_ips)->default_value(options.source_ips),
+             "Number of consecutive source IPs")
+            ("source-ports", po::value(&source_ports)->default_value(source_ports), "Range of source ports")
+        ;
+        po::variables_map vars_map;
+        po::store(po::parse_command_line(argc, argv, description), vars_map);
+        po::notify(vars_map);
+        if (vars_map.count("help")) {
+            std::cout << description << std::endl;
+            std::exit(0);
+        }
+
+        options.target = parse_endpoint(target);
+        options.is_backend_bundled = (vars_map.count("no-backend") == 0);
+        options.is_backend_fast_open = (vars_map.count("backend-fast-open") != 0);
+        options.source_ip = boost::asio::ip::address_v4::from_string(source_ip);
+        std::vector<std::string> ports;
+        boost::split(ports, source_ports, [](char c) { return (c == '-'); });
+        options.source_port_min = boost::lexical_cast<uint16_t>(ports.at(0));
+        options.source_port_max = boost::lexical_cast<uint16_t>(ports.at(ports.size() > 1 ? 1 : 0));
+        if (options.threads == 0 || options.source_ips == 0 || options.source_port_min > options.source_port_max)
+            throw std::runtime_error("Invalid options, see --help");
+        return options;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        auto options = parse_options(argc, argv);
+        options.concurrency = std::max<size_t>(std::min(options.concurrency, options.connections), 1);
+
+        std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts;
+        std::vector<std::shared_ptr<Backend>> backends;
+        for (unsigned i = 0; i < options.threads; ++i) {
+            io_contexts.emplace_back(new boost::asio::io_context(1));
+            if (options.is_backend_bundled) {
+                backends.push_back(std::make_shared<Backend>(options, *io_contexts.back()));
+                backends.back()->start();
+            }
+        }
+
+        // Backends serve clients of all threads, so they are stopped after the last client
+        std::atomic<size_t> finished_clients(0);
+        auto on_client_finished = [&]() {
+            if (finished_clients.fetch_add(1) + 1 != options.concurrency)
+                return;
+            for (size_t i = 0; i < backends.size(); ++i) {
+                auto backend = backends[i];
+                io_contexts[i]->post([backend]() { backend->stop(); });
+            }
+        };
+
+        std::atomic<size_t> next_connection(0);
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (unsigned i = 0; i < options.threads; ++i) {
+            workers.emplace_back(new Worker(options, *io_contexts[i], next_connection, on_client_finished));
+            // Concurrency is distributed between threads
+            workers.back()->start(options.concurrency / options.threads + (i < options.concurrency % options.threads));
+        }
+
+        auto start_time = Clock::now();
+        std::vector<std::thread> threads;
+        for (auto& io_context : io_contexts) {
+            auto context = io_context.get();
+            threads.emplace_back([context]() { context->run(); });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        auto seconds = std::chrono::duration<double>(Clock::now() - start_time).count();
+
+        Results results;
+        for (const auto& worker : workers)
+            results.merge(worker->results());
+        std::printf("Connections: %zu, errors: %zu, time: %.2f s\n", results.transfer.size(), results.errors, seconds);
+        std::printf("Connections/s: %.0f, throughput: %.1f MB/s\n",
+                    results.transfer.size() / seconds, results.bytes / seconds / 1e6);
+        std::printf("%-12s %10s %10s %10s %10s\n", "Latency, us", "p50", "p99", "p999", "max");
+        print_latency("connect", results.connect);
+        print_latency("first byte", results.first_byte);
+        print_latency("transfer", results.transfer);
+        return (results.errors == 0) ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
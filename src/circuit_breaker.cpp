@@ -0,0 +1,101 @@
+#include "circuit_breaker.h"
+
+namespace progdn
+{
+    CircuitBreaker::CircuitBreaker(const Settings& settings) :
+        m_settings(settings),
+        m_entries_number(0)
+    {
+    }
+
+    bool CircuitBreaker::allow(const boost::asio::ip::tcp::endpoint& destination, Attempt& attempt) noexcept
+    {
+        attempt.release();
+        attempt.m_owner = this;
+        attempt.m_destination = destination;
+        if (m_entries_number.load(std::memory_order_acquire) == 0)
+            return true;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(destination);
+        if (it == m_entries.end() || it->second.open_until == Clock::time_point())
+            return true;
+        auto& entry = it->second;
+        if (entry.is_probing || Clock::now() < entry.open_until) {
+            attempt.m_owner = nullptr;
+            return false;
+        }
+        entry.is_probing = true;
+        attempt.m_is_probe = true;
+        return true;
+    }
+
+    bool CircuitBreaker::on_success(const boost::asio::ip::tcp::endpoint& destination) noexcept
+    {
+        if (m_entries_number.load(std::memory_order_acquire) == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(destination);
+        if (it == m_entries.end())
+            return false;
+        auto was_open = (it->second.open_until != Clock::time_point());
+        m_entries.erase(it);
+        m_entries_number.store(m_entries.size(), std::memory_order_release);
+        return was_open;
+    }
+
+    bool CircuitBreaker::on_failure(const boost::asio::ip::tcp::endpoint& destination, bool is_probe) noexcept
+    {
+        try {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto& entry = m_entries.emplace(destination, Entry{ 0, Clock::time_point(), false }).first->second;
+            m_entries_number.store(m_entries.size(), std::memory_order_release);
+            auto was_open = (entry.open_until != Clock::time_point());
+            // Sessions, which started connecting before destination became unavailable, do not extend cool-down
+            if (was_open && !is_probe)
+                return false;
+            ++entry.failures;
+            if (entry.failures < m_settings.failures_threshold)
+                return false;
+            entry.open_until = Clock::now() + m_settings.cooldown;
+            entry.is_probing = false;
+            return !was_open;
+        } catch (...) {
+            return false;
+        }
+    }
+
+    void CircuitBreaker::on_abandoned_probe(const boost::asio::ip::tcp::endpoint& destination) noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(destination);
+        if (it != m_entries.end())
+            it->second.is_probing = false;
+    }
+
+    bool CircuitBreaker::Attempt::succeed() noexcept
+    {
+        if (!m_owner)
+            return false;
+        auto owner = m_owner;
+        m_owner = nullptr;
+        return owner->on_success(m_destination);
+    }
+
+    bool CircuitBreaker::Attempt::fail() noexcept
+    {
+        if (!m_owner)
+            return false;
+        auto owner = m_owner;
+        m_owner = nullptr;
+        return owner->on_failure(m_destination, m_is_probe);
+    }
+
+    void CircuitBreaker::Attempt::release() noexcept
+    {
+        if (m_owner && m_is_probe)
+            m_owner->on_abandoned_probe(m_destination);
+        m_owner = nullptr;
+        m_is_probe = false;
+    }
+}
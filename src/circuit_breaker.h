@@ -0,0 +1,90 @@
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace progdn
+{
+    // Circuit breaker per destination server (address and port). After a number of consecutive failures to connect,
+    // destination is unavailable: sessions to it are rejected at once during cool-down, then a single session is let
+    // through as a probe. Successful connection (of the probe or of any session) makes destination available again,
+    // failure of the probe starts a new cool-down.
+    //
+    // Only failing destinations are kept in the table, and the table is not locked, while it is empty.
+    class CircuitBreaker : public boost::noncopyable
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        struct Settings {
+            // Consecutive failures to connect, after which destination is unavailable
+            uint32_t failures_threshold;
+            Clock::duration cooldown;
+        };
+
+        // Connection to a destination allowed by the breaker. Outcome is reported by succeed() or fail(); without
+        // it (session is closed before connection is made) the probe is released, so the next session probes.
+        class Attempt : public boost::noncopyable
+        {
+            friend class CircuitBreaker;
+
+        private:
+            CircuitBreaker* m_owner = nullptr;
+            boost::asio::ip::tcp::endpoint m_destination;
+            bool m_is_probe = false;
+
+        public:
+            Attempt() = default;
+
+            ~Attempt() {
+                release();
+            }
+
+        public:
+            bool is_probe() const noexcept {
+                return m_is_probe;
+            }
+
+            // Returns true, when unavailable destination becomes available
+            bool succeed() noexcept;
+            // Returns true, when destination becomes unavailable
+            bool fail() noexcept;
+
+        private:
+            void release() noexcept;
+        };
+
+    private:
+        struct Entry {
+            uint32_t failures;
+            // Time, when the next probe is allowed (zero - destination is available)
+            Clock::time_point open_until;
+            bool is_probing;
+        };
+
+    private:
+        const Settings m_settings;
+        std::mutex m_mutex;
+        std::map<boost::asio::ip::tcp::endpoint, Entry> m_entries;
+        std::atomic<size_t> m_entries_number;
+
+    public:
+        explicit CircuitBreaker(const Settings& settings);
+
+    public:
+        // Returns false, when destination is unavailable (session must be rejected)
+        bool allow(const boost::asio::ip::tcp::endpoint& destination, Attempt& attempt) noexcept;
+
+    private:
+        bool on_success(const boost::asio::ip::tcp::endpoint& destination) noexcept;
+        bool on_failure(const boost::asio::ip::tcp::endpoint& destination, bool is_probe) noexcept;
+        void on_abandoned_probe(const boost::asio::ip::tcp::endpoint& destination) noexcept;
+    };
+}
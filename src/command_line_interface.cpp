@@ -12,6 +12,8 @@ namespace progdn
             "Allowed options")
     {
         auto conf_help = (boost::format("Path to configuration file. Default: %1%") % conf).str();
+        auto log_level_help = (boost::format("Maximal level of logged records: error, warning, info or debug. "
+                                             "Default: %1%") % log_level).str();
         m_description.add_options()
             (kOption_Help,
              "Produce help message and exit")
@@ -24,6 +26,9 @@ namespace progdn
              conf_help.c_str())
             (kOption_Background,
              "Run in background")
+            (kOption_LogLevel,
+             boost::program_options::value(&log_level),
+             log_level_help.c_str())
         ;
         boost::program_options::store(boost::program_options::parse_command_line(argc, argv, m_description), m_vars_map);
         boost::program_options::notify(m_vars_map);
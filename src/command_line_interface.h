@@ -12,9 +12,11 @@ namespace progdn
         static constexpr auto kOption_Verbose = "verbose";
         static constexpr auto kOption_Conf    = "conf";
         static constexpr auto kOption_Background = "background";
+        static constexpr auto kOption_LogLevel = "log-level";
 
     public:
         std::string conf = "progdn-rvi.conf";
+        std::string log_level = "debug";
 
     private:
         boost::program_options::options_description m_description;
@@ -0,0 +1,277 @@
+#include "haproxy_protocol.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace progdn
+{
+    namespace haproxy_protocol {
+
+        namespace v1 {
+            // Single-pass parser of text header, which runs over received data once
+            class Parser
+            {
+            public:
+                // Result of parsing of a single field
+                enum class Step { Done, OutOfData, Failed };
+
+            private:
+                const char* m_pos;
+                const char* m_end;
+
+            public:
+                Parser(const char* data, size_t size) noexcept :
+                    m_pos(data),
+                    m_end(data + std::min(size, kMaximalHeaderSize)) {
+                }
+
+            public:
+                size_t parsed_size(const char* data) const noexcept {
+                    return static_cast<size_t>(m_pos - data);
+                }
+
+                Step expect(const char* literal) noexcept {
+                    for (; *literal; ++literal, ++m_pos) {
+                        if (m_pos == m_end)
+                            return Step::OutOfData;
+                        if (*m_pos != *literal)
+                            return Step::Failed;
+                    }
+                    return Step::Done;
+                }
+
+                // Digit '4' or '6' after "TCP"
+                Step read_ip_version(bool& is_ipv6) noexcept {
+                    if (m_pos == m_end)
+                        return Step::OutOfData;
+                    if (*m_pos != '4' && *m_pos != '6')
+                        return Step::Failed;
+                    is_ipv6 = (*m_pos++ == '6');
+                    return Step::Done;
+                }
+
+                // Dotted-decimal IPv4 address followed by a space
+                Step read_ipv4(boost::asio::ip::address& ip) noexcept {
+                    uint32_t host = 0;
+                    for (int octet_index = 0; octet_index < 4; ++octet_index) {
+                        unsigned octet;
+                        auto step = read_number(3, 255, octet_index < 3 ? '.' : ' ', octet);
+                        if (step != Step::Done)
+                            return step;
+                        host = (host << 8) | octet;
+                    }
+                    ip = boost::asio::ip::address_v4(host);
+                    return Step::Done;
+                }
+
+                // Textual IPv6 address followed by a space
+                Step read_ipv6(boost::asio::ip::address& ip) noexcept {
+                    // "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255" and null
+                    char text[46];
+                    size_t text_size = 0;
+                    for (;; ++m_pos) {
+                        if (m_pos == m_end)
+                            return Step::OutOfData;
+                        auto c = *m_pos;
+                        if (c == ' ')
+                            break;
+                        auto is_allowed = std::isxdigit(static_cast<unsigned char>(c)) || c == ':' || c == '.';
+                        if (!is_allowed || text_size + 1 == sizeof(text))
+                            return Step::Failed;
+                        text[text_size++] = c;
+                    }
+                    ++m_pos;
+                    text[text_size] = 0;
+                    boost::asio::ip::address_v6::bytes_type bytes;
+                    if (::inet_pton(AF_INET6, text, bytes.data()) != 1)
+                        return Step::Failed;
+                    ip = boost::asio::ip::address_v6(bytes);
+                    return Step::Done;
+                }
+
+                // Decimal port followed by "terminator"
+                Step read_port(char terminator, uint16_t& port) noexcept {
+                    unsigned value;
+                    auto step = read_number(5, 65535, terminator, value);
+                    port = static_cast<uint16_t>(value);
+                    return step;
+                }
+
+            private:
+                Step read_number(size_t max_digits, unsigned max_value, char terminator, unsigned& value) noexcept {
+                    value = 0;
+                    for (size_t digits = 0;; ++digits, ++m_pos) {
+                        if (m_pos == m_end)
+                            return Step::OutOfData;
+                        auto c = *m_pos;
+                        if (c == terminator && digits > 0)
+                            break;
+                        if (c < '0' || c > '9' || digits == max_digits)
+                            return Step::Failed;
+                        value = value * 10 + static_cast<unsigned>(c - '0');
+                    }
+                    ++m_pos;
+                    return (value <= max_value) ? Step::Done : Step::Failed;
+                }
+            };
+
+            static ParseResult parse(const char* data, size_t size, Header& header) noexcept
+            {
+                Parser parser(data, size);
+                // Running out of data is not a failure, unless header does not fit into its maximal size
+                auto check = [size](Parser::Step step, Error error) -> ParseResult {
+                    if (step == Parser::Step::OutOfData) {
+                        if (size < kMaximalHeaderSize)
+                            return { ParseStatus::Incomplete, 0, Error::None };
+                        return { ParseStatus::Invalid, 0, Error::TooLongHeader };
+                    }
+                    return { ParseStatus::Invalid, 0, error };
+                };
+
+                auto step = parser.expect("PROXY ");
+                if (step != Parser::Step::Done)
+                    return check(step, Error::NotProxyProtocol);
+                bool is_ipv6 = false;
+                step = parser.expect("TCP");
+                if (step == Parser::Step::Done)
+                    step = parser.read_ip_version(is_ipv6);
+                if (step == Parser::Step::Done)
+                    step = parser.expect(" ");
+                if (step != Parser::Step::Done)
+                    return check(step, Error::UnsupportedProtocol);
+                step = is_ipv6 ? parser.read_ipv6(header.src_ip) : parser.read_ipv4(header.src_ip);
+                if (step == Parser::Step::Done)
+                    step = is_ipv6 ? parser.read_ipv6(header.dst_ip) : parser.read_ipv4(header.dst_ip);
+                if (step != Parser::Step::Done)
+                    return check(step, Error::MalformedAddress);
+                step = parser.read_port(' ', header.src_port);
+                if (step == Parser::Step::Done)
+                    step = parser.read_port('\r', header.dst_port);
+                if (step != Parser::Step::Done)
+                    return check(step, Error::MalformedPort);
+                step = parser.expect("\n");
+                if (step != Parser::Step::Done)
+                    return check(step, Error::MalformedHeader);
+                return { ParseStatus::Complete, parser.parsed_size(data), Error::None };
+            }
+        }
+
+        namespace v2 {
+            const char kSignature[kSignatureSize] = {
+                '\x0D', '\x0A', '\x0D', '\x0A', '\x00', '\x0D', '\x0A', '\x51', '\x55', '\x49', '\x54', '\x0A'
+            };
+
+            static const uint8_t kVersion = 0x20;
+            static const uint8_t kCommandLocal = 0x00;
+            static const uint8_t kCommandProxy = 0x01;
+            static const uint8_t kTcpOverIPv4 = 0x11;
+            static const uint8_t kTcpOverIPv6 = 0x21;
+
+            static uint16_t read_port(const uint8_t* data) noexcept {
+                return static_cast<uint16_t>((data[0] << 8) | data[1]);
+            }
+
+            static ParseResult parse(const char* data, size_t size, Header& header) noexcept
+            {
+                if (std::memcmp(data, kSignature, std::min(size, kSignatureSize)) != 0)
+                    return { ParseStatus::Invalid, 0, Error::NotProxyProtocol };
+                if (size < kFixedHeaderSize)
+                    return { ParseStatus::Incomplete, 0, Error::None };
+
+                auto fixed_header = reinterpret_cast<const uint8_t*>(data);
+                auto version_command = fixed_header[12];
+                auto family_protocol = fixed_header[13];
+                size_t header_size = kFixedHeaderSize + read_port(fixed_header + 14);
+                if ((version_command & 0xF0) != kVersion)
+                    return { ParseStatus::Invalid, 0, Error::UnsupportedVersion };
+                switch (version_command & 0x0F) {
+                case kCommandProxy:
+                    break;
+                case kCommandLocal:
+                    // Address block (of any family) is discarded along with TLVs
+                    header.is_local = true;
+                    return { ParseStatus::Complete, header_size, Error::None };
+                default:
+                    return { ParseStatus::Invalid, 0, Error::UnsupportedCommand };
+                }
+
+                // Addresses are followed by TLVs, which are skipped
+                size_t addresses_size;
+                switch (family_protocol) {
+                case kTcpOverIPv4:
+                    addresses_size = 2 * 4 + 2 * 2;
+                    break;
+                case kTcpOverIPv6:
+                    addresses_size = 2 * 16 + 2 * 2;
+                    break;
+                default:
+                    return { ParseStatus::Invalid, 0, Error::UnsupportedProtocol };
+                }
+                if (header_size < kFixedHeaderSize + addresses_size)
+                    return { ParseStatus::Invalid, 0, Error::MalformedHeader };
+                if (size < kFixedHeaderSize + addresses_size)
+                    return { ParseStatus::Incomplete, 0, Error::None };
+
+                auto addresses = fixed_header + kFixedHeaderSize;
+                if (family_protocol == kTcpOverIPv4) {
+                    boost::asio::ip::address_v4::bytes_type src_ip, dst_ip;
+                    std::memcpy(src_ip.data(), addresses, 4);
+                    std::memcpy(dst_ip.data(), addresses + 4, 4);
+                    header.src_ip = boost::asio::ip::address_v4(src_ip);
+                    header.dst_ip = boost::asio::ip::address_v4(dst_ip);
+                    addresses += 8;
+                } else {
+                    boost::asio::ip::address_v6::bytes_type src_ip, dst_ip;
+                    std::memcpy(src_ip.data(), addresses, 16);
+                    std::memcpy(dst_ip.data(), addresses + 16, 16);
+                    header.src_ip = boost::asio::ip::address_v6(src_ip);
+                    header.dst_ip = boost::asio::ip::address_v6(dst_ip);
+                    addresses += 32;
+                }
+                header.src_port = read_port(addresses);
+                header.dst_port = read_port(addresses + 2);
+                return { ParseStatus::Complete, header_size, Error::None };
+            }
+        }
+
+        const char* to_string(Error error) noexcept
+        {
+            switch (error)
+            {
+            case Error::None:
+                return "No error";
+            case Error::NotProxyProtocol:
+                return "Not a PROXY protocol header";
+            case Error::TooLongHeader:
+                return "Too long header";
+            case Error::UnsupportedVersion:
+                return "Unsupported version";
+            case Error::UnsupportedCommand:
+                return "Unsupported command";
+            case Error::UnsupportedProtocol:
+                return "Only TCP over IPv4 and IPv6 is supported";
+            case Error::MalformedAddress:
+                return "Malformed address";
+            case Error::MalformedPort:
+                return "Malformed port";
+            case Error::MalformedHeader:
+                return "Malformed header";
+            default:
+                return "???";
+            };
+        }
+
+        ParseResult parse(const char* data, size_t size, Header& header) noexcept
+        {
+            if (size == 0)
+                return { ParseStatus::Incomplete, 0, Error::None };
+            header.is_local = false;
+            if (data[0] == v2::kSignature[0])
+                return v2::parse(data, size, header);
+            return v1::parse(data, size, header);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <boost/asio/ip/address.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace progdn
+{
+    // HAProxy Protocol Header (Versions 1 and 2)
+    // https://www.haproxy.org/download/1.8/doc/proxy-protocol.txt
+    namespace haproxy_protocol {
+
+        namespace v1 {
+            // "PROXY TCP6 <39 chars> <39 chars> 65535 65535\r\n"
+            static const size_t kMaximalHeaderSize = 107;
+        }
+
+        namespace v2 {
+            static const size_t kSignatureSize = 12;
+            extern const char kSignature[kSignatureSize];
+            // Signature, version/command, family/protocol, length of addresses
+            static const size_t kFixedHeaderSize = 16;
+            // Fixed part and the largest address block (AF_UNIX) without TLVs
+            static const size_t kMaximalHeaderSize = kFixedHeaderSize + 216;
+        }
+
+        // Size of buffer enough to receive any header (except TLVs of version 2, which are skipped)
+        static const size_t kMaximalHeaderSize = v2::kMaximalHeaderSize;
+
+        struct Header {
+            boost::asio::ip::address src_ip;
+            boost::asio::ip::address dst_ip;
+            uint16_t src_port;
+            uint16_t dst_port;
+            // Connection is made by the proxy itself (command LOCAL of version 2, for example, health check):
+            // addresses are not specified, the connection has no visitor
+            bool is_local;
+        };
+
+        enum class ParseStatus {
+            // Header is parsed, "header_size" is set
+            Complete,
+            // More data is needed to parse header
+            Incomplete,
+            // Data is not a valid or supported header, "error" is set
+            Invalid
+        };
+
+        enum class Error {
+            None,
+            NotProxyProtocol,
+            TooLongHeader,
+            UnsupportedVersion,
+            UnsupportedCommand,
+            UnsupportedProtocol,
+            MalformedAddress,
+            MalformedPort,
+            // Any other violation of format
+            MalformedHeader,
+            kErrorsNumber
+        };
+
+        const char* to_string(Error error) noexcept;
+
+        struct ParseResult {
+            ParseStatus status;
+            // Total size of header (for version 2 it includes TLVs, which may be not received yet)
+            size_t header_size;
+            Error error;
+        };
+
+        // Parses header (version is detected automatically) from the beginning of received data.
+        // Never throws and never allocates memory.
+        ParseResult parse(const char* data, size_t size, Header& header) noexcept;
+    }
+}
@@ -0,0 +1,261 @@
+#include "listener_handoff.h"
+
+#include <progdn_core/log.h>
+
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace progdn
+{
+    namespace
+    {
+        // Limit of descriptors in a message is SCM_MAX_FD (253), so they are sent by parts
+        const size_t kMaximalFdsPerMessage = 64;
+        // Byte, which follows the last part of descriptors, and byte of confirmation
+        const char kLastPart = 0;
+        const char kMorePartsFollow = 1;
+        const char kConfirmation = 1;
+
+        void send_fds(int sock, const std::vector<int>& fds)
+        {
+            size_t fds_sent = 0;
+            do {
+                auto fds_number = std::min(fds.size() - fds_sent, kMaximalFdsPerMessage);
+                char marker = (fds_sent + fds_number < fds.size()) ? kMorePartsFollow : kLastPart;
+                iovec data = { &marker, sizeof(marker) };
+                std::vector<char> control(CMSG_SPACE(kMaximalFdsPerMessage * sizeof(int)));
+                msghdr message = {};
+                message.msg_iov = &data;
+                message.msg_iovlen = 1;
+                if (fds_number > 0) {
+                    message.msg_control = control.data();
+                    message.msg_controllen = CMSG_SPACE(fds_number * sizeof(int));
+                    auto header = CMSG_FIRSTHDR(&message);
+                    header->cmsg_level = SOL_SOCKET;
+                    header->cmsg_type = SCM_RIGHTS;
+                    header->cmsg_len = CMSG_LEN(fds_number * sizeof(int));
+                    std::memcpy(CMSG_DATA(header), &fds[fds_sent], fds_number * sizeof(int));
+                }
+                if (::sendmsg(sock, &message, MSG_NOSIGNAL) < 0)
+                    throw boost::system::system_error(errno, boost::system::system_category(), "sendmsg");
+                fds_sent += fds_number;
+            } while (fds_sent < fds.size());
+        }
+
+        // Received descriptors are appended to "fds" (even on failure, so they can be closed)
+        void receive_fds(int sock, std::vector<int>& fds)
+        {
+            char marker = kMorePartsFollow;
+            while (marker == kMorePartsFollow) {
+                iovec data = { &marker, sizeof(marker) };
+                std::vector<char> control(CMSG_SPACE(kMaximalFdsPerMessage * sizeof(int)));
+                msghdr message = {};
+                message.msg_iov = &data;
+                message.msg_iovlen = 1;
+                message.msg_control = control.data();
+                message.msg_controllen = control.size();
+                auto bytes_received = ::recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+                if (bytes_received < 0)
+                    throw boost::system::system_error(errno, boost::system::system_category(), "recvmsg");
+                if (bytes_received == 0)
+                    throw std::runtime_error("Connection is closed by running instance");
+                for (auto header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+                    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+                        continue;
+                    auto fds_number = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    auto begin = reinterpret_cast<const int*>(CMSG_DATA(header));
+                    fds.insert(fds.end(), begin, begin + fds_number);
+                }
+                if (message.msg_flags & MSG_CTRUNC)
+                    throw std::runtime_error("Listening sockets are truncated");
+            }
+        }
+
+        void close_all(const std::vector<int>& fds) noexcept
+        {
+            for (auto fd : fds)
+                ::close(fd);
+        }
+    }
+
+    ListenerHandoff::ListenerHandoff(const std::shared_ptr<boost::asio::io_context>& io_context, const std::string& path) :
+        m_io_context(io_context),
+        m_path(path),
+        m_acceptor(*m_io_context)
+    {
+    }
+
+    ListenerHandoff::~ListenerHandoff()
+    {
+        // Previous instance continues accepting without confirmation
+        if (m_predecessor_fd >= 0)
+            ::close(m_predecessor_fd);
+    }
+
+    std::vector<int> ListenerHandoff::take(const boost::asio::ip::tcp::endpoint& listen)
+    {
+        // Running instance answers at once, so start of this one is not delayed for long
+        static const time_t kTimeToReceive = 5;
+
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (m_path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Too long path of listener handoff: " + m_path);
+        std::memcpy(address.sun_path, m_path.c_str(), m_path.size());
+
+        auto sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0)
+            throw boost::system::system_error(errno, boost::system::system_category(), "socket");
+        if (::connect(sock, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            auto error = errno;
+            ::close(sock);
+            if (error == ENOENT || error == ECONNREFUSED) {
+                Log::info("No running instance at " + m_path);
+                return {};
+            }
+            throw std::runtime_error("Cannot connect to running instance at " + m_path + ": " + ::strerror(error));
+        }
+        timeval timeout = { kTimeToReceive, 0 };
+        ::setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        // Sockets are served by both instances, if they cannot be taken
+        std::vector<int> fds;
+        try {
+            receive_fds(sock, fds);
+        } catch (const std::exception& e) {
+            close_all(fds);
+            ::close(sock);
+            PROGDN_LOG_WARNING("Cannot take listening sockets from running instance: ", e.what());
+            return {};
+        }
+
+        for (auto fd : fds) {
+            boost::asio::ip::tcp::endpoint local_endpoint;
+            socklen_t size = static_cast<socklen_t>(local_endpoint.capacity());
+            if (::getsockname(fd, local_endpoint.data(), &size) < 0 || local_endpoint != listen) {
+                PROGDN_LOG_WARNING("Listening sockets of running instance are not bound to ", listen);
+                close_all(fds);
+                ::close(sock);
+                return {};
+            }
+        }
+        PROGDN_LOG_INFO("Taken listening sockets from running instance: ", fds.size());
+        m_predecessor_fd = sock;
+        return fds;
+    }
+
+    void ListenerHandoff::confirm() noexcept
+    {
+        if (m_predecessor_fd < 0)
+            return;
+        if (::send(m_predecessor_fd, &kConfirmation, sizeof(kConfirmation), MSG_NOSIGNAL) < 0)
+            PROGDN_LOG_WARNING("Cannot confirm handoff of listening sockets: ", std::strerror(errno));
+        ::close(m_predecessor_fd);
+        m_predecessor_fd = -1;
+    }
+
+    void ListenerHandoff::start(const std::vector<int>& listening_fds, std::function<void()> on_handed_off)
+    {
+        m_listening_fds = listening_fds;
+        m_on_handed_off = std::move(on_handed_off);
+        // Socket file is left by previous instance
+        ::unlink(m_path.c_str());
+        m_acceptor.open();
+        m_acceptor.bind(Protocol::endpoint(m_path));
+        m_acceptor.listen();
+        boost::asio::co_spawn(*m_io_context, accept(shared_from_this()), boost::asio::detached);
+    }
+
+    void ListenerHandoff::shutdown() noexcept
+    {
+        m_is_shutdown_requested = true;
+        if (!m_acceptor.is_open())
+            return;
+        boost::system::error_code error;
+        m_acceptor.close(error);
+        // Socket file belongs to the new instance since handoff
+        if (!m_is_handed_off)
+            ::unlink(m_path.c_str());
+    }
+
+    Awaitable<> ListenerHandoff::accept(std::shared_ptr<ListenerHandoff> self)
+    {
+        // Pause after failure (for example, on the limit of open files) grows, while failures repeat
+        static const std::chrono::milliseconds kMinimalBackoff(10);
+        static const std::chrono::milliseconds kMaximalBackoff(1000);
+
+        boost::asio::steady_timer pause_timer(*self->m_io_context);
+        auto backoff = kMinimalBackoff;
+        while (!self->m_is_shutdown_requested)
+        {
+            Protocol::socket sock(*self->m_io_context);
+            boost::system::error_code error;
+            co_await self->m_acceptor.async_accept(sock, with_error(error));
+            if (error) {
+                if (error != boost::asio::error::operation_aborted) {
+                    PROGDN_LOG_ERROR("Cannot accept new instance: ", error, ", retry in ", backoff.count(), " ms");
+                    pause_timer.expires_after(backoff);
+                    co_await pause_timer.async_wait(with_error(error));
+                    backoff = std::min(backoff * 2, kMaximalBackoff);
+                }
+                continue;
+            }
+            backoff = kMinimalBackoff;
+            try {
+                if (co_await self->hand_over(sock)) {
+                    Log::info("Listening sockets are handed over to new instance");
+                    self->m_is_handed_off = true;
+                    self->shutdown();
+                    self->m_on_handed_off();
+                }
+            } catch (const std::exception& e) {
+                PROGDN_LOG_ERROR("Cannot hand over listening sockets: ", e.what());
+            }
+        }
+    }
+
+    Awaitable<bool> ListenerHandoff::hand_over(Protocol::socket& sock)
+    {
+        // New instance confirms after it has bound the rest of its sockets
+        static const std::chrono::seconds kTimeToConfirm(10);
+
+        send_fds(sock.native_handle(), m_listening_fds);
+
+        // Handler of the timer may be already queued, when the read completes (cancel() does not stop it), so it
+        // touches the socket only while the read is in progress
+        auto is_read_finished = std::make_shared<bool>(false);
+        boost::asio::steady_timer timer(*m_io_context);
+        timer.expires_after(kTimeToConfirm);
+        timer.async_wait([&sock, is_read_finished](const boost::system::error_code& error) {
+            if (!*is_read_finished && error != boost::asio::error::operation_aborted) {
+                boost::system::error_code cancel_error;
+                sock.cancel(cancel_error);
+            }
+        });
+        char confirmation = 0;
+        boost::system::error_code error;
+        co_await boost::asio::async_read(sock, boost::asio::buffer(&confirmation, 1), with_error(error));
+        *is_read_finished = true;
+        timer.cancel();
+        if (error) {
+            PROGDN_LOG_WARNING("New instance has not confirmed handoff of listening sockets: ", error);
+            co_return false;
+        }
+        // Protocol of handoff differs (for example, instances of incompatible versions)
+        if (confirmation != kConfirmation) {
+            PROGDN_LOG_WARNING("New instance has sent unexpected confirmation of handoff of listening sockets: ",
+                               static_cast<int>(static_cast<unsigned char>(confirmation)));
+            co_return false;
+        }
+        co_return true;
+    }
+}
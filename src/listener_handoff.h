@@ -0,0 +1,62 @@
+#pragma once
+
+#include <progdn_core/awaitable.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace progdn
+{
+    // Passes listening sockets from the running instance to a new one over Unix domain socket (SCM_RIGHTS), so
+    // upgrade does not refuse SYNs and does not reset connections waiting in the accept queue.
+    //
+    // New instance takes sockets before it starts accepting and confirms, when all of them are served; only then
+    // the running instance stops accepting. Each instance serves the path for its successor.
+    class ListenerHandoff : public std::enable_shared_from_this<ListenerHandoff>
+    {
+    private:
+        using Protocol = boost::asio::local::stream_protocol;
+
+    private:
+        std::shared_ptr<boost::asio::io_context> m_io_context;
+        const std::string m_path;
+        Protocol::acceptor m_acceptor;
+        // Connection with previous instance, which waits for confirmation (-1 - none)
+        int m_predecessor_fd = -1;
+        // Listening sockets handed to a new instance
+        std::vector<int> m_listening_fds;
+        std::function<void()> m_on_handed_off;
+        bool m_is_shutdown_requested = false;
+        bool m_is_handed_off = false;
+
+    public:
+        ListenerHandoff(const std::shared_ptr<boost::asio::io_context>& io_context, const std::string& path);
+        ~ListenerHandoff();
+
+    public:
+        // Takes listening sockets bound to "listen" from the running instance.
+        // Returns no sockets, when there is no running instance (or its sockets are bound to other address).
+        std::vector<int> take(const boost::asio::ip::tcp::endpoint& listen);
+
+        // Tells previous instance, that taken sockets are served, so it may stop accepting
+        void confirm() noexcept;
+
+        // Serves the path for the next instance: hands over "listening_fds" and calls "on_handed_off"
+        // after its confirmation (within the thread of io_context)
+        void start(const std::vector<int>& listening_fds, std::function<void()> on_handed_off);
+
+        // Must be called within the thread of io_context
+        void shutdown() noexcept;
+
+    private:
+        // Handoff is kept alive by the coroutine until acceptor is closed
+        static Awaitable<> accept(std::shared_ptr<ListenerHandoff> self);
+        Awaitable<bool> hand_over(Protocol::socket& sock);
+    };
+}
@@ -1,23 +1,57 @@
+#include "admission_control.h"
+#include "circuit_breaker.h"
 #include "command_line_interface.h"
+#include "haproxy_protocol.h"
+#include "listener_handoff.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "routing_table.h"
+#include "session_trace.h"
+#include "stats_server.h"
 
+#include <progdn_core/async_log_writer.h>
+#include <progdn_core/awaitable.h>
+#include <progdn_core/buffer_pool.h>
+#include <progdn_core/cpu_affinity.h>
 #include <progdn_core/ini_file.h>
-#include <progdn_core/ip_address_helper.h>
+#ifdef PROGDN_RVI_IO_URING
+#include <progdn_core/io_uring.h>
+#endif
+#include <progdn_core/pipe.h>
+#include <progdn_core/reserve_descriptor.h>
+#ifdef PROGDN_RVI_SOCKMAP
+#include <progdn_core/sockmap.h>
+#endif
 #include <progdn_core/system_limits.h>
 #include <progdn_core/system_log.h>
+#include <progdn_core/timing_wheel.h>
 
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/asio/read.hpp>
-#include <boost/asio/spawn.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/asio/write.hpp>
-#include <boost/asio/deadline_timer.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/utility/string_view.hpp>
 
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+#include <future>
 #include <iostream>
+#include <list>
 #include <memory>
+#include <thread>
 
 namespace progdn
 {
@@ -34,330 +68,1550 @@ namespace progdn
         }
     }
 
-    // HAProxy Protocol Header (Version 1)
-    // https://www.haproxy.org/download/1.8/doc/proxy-protocol.txt
-    namespace haproxy_protocol {
-
-        static boost::string_view kEndMarker("\r\n");
-        namespace tcp4 {
-            static const size_t kMaximalHeaderSize = 56;
-        }
-
-        struct Header {
-            IP_Host src_ip;
-            IP_Host dst_ip;
-            uint16_t src_port;
-            uint16_t dst_port;
+    struct Config {
+        // Engine, which moves payload between client and destination server
+        enum class Relay {
+            // Through user-space buffer (read + write)
+            Copy,
+            // Through kernel pipe (splice), payload is not copied to user space
+            Splice,
+            // Through buffers provided to io_uring, operations of a thread are submitted by a single system call
+            IoUring,
+            // By the kernel between sockets inserted into BPF sockmap, payload is not seen by user space at all
+            Sockmap
         };
-    }
 
-    struct Config {
         boost::asio::ip::tcp::endpoint listen;
+        // Connections to destination server are made from client's address (IP_TRANSPARENT, needs root and routing
+        // of marked packets). Otherwise they are made from loopback, which is enough for benchmarks and tests.
+        bool transparent;
         int mark;
         int table;
+        // Number of event loops, each one with own acceptor (0 - one per CPU)
+        unsigned threads;
+        // CPUs, to which event loops are pinned (thread i - to CPU i modulo size; empty - not pinned)
+        std::vector<unsigned> cpu_affinity;
+        Relay relay;
+        // Maximal number of free relay buffers of each size kept by each thread
+        size_t buffer_pool_capacity;
+        // Number of buffers (16 KB) provided to io_uring by each thread
+        uint16_t io_uring_buffers;
+        // Time to receive PROXY header
+        TimingWheel::Duration header_timeout;
+        // Time without payload in both directions, after which session is closed (0 - unlimited)
+        TimingWheel::Duration idle_timeout;
+        // Time without payload from client / from destination server, after which session is closed (0 - unlimited)
+        TimingWheel::Duration client_idle_timeout;
+        TimingWheel::Duration server_idle_timeout;
+        // Time after end of payload in one direction, after which half-closed session is closed (0 - unlimited)
+        TimingWheel::Duration half_closed_timeout;
+        // Total time of session, after which it is closed (0 - unlimited)
+        TimingWheel::Duration session_lifetime;
+        // TCP keepalive of connections with client and destination server (0 - disabled)
+        TimingWheel::Duration tcp_keepalive_time;
+        TimingWheel::Duration tcp_keepalive_interval;
+        int tcp_keepalive_probes;
+        // Option TCP_USER_TIMEOUT of connections with client and destination server (0 - system default)
+        TimingWheel::Duration tcp_user_timeout;
+        // Payload received along with PROXY header is sent to destination server in SYN (TCP Fast Open)
+        bool tcp_fastopen_connect;
+        // Limits per source IP from PROXY header: concurrent sessions and connect rate (0 - unlimited)
+        uint32_t max_connections_per_ip;
+        double connect_rate_per_ip;
+        double connect_burst_per_ip;
+        // Number of source IPs tracked at once by the limits
+        size_t admission_table_size;
+        // Maximal number of sessions, after which connections are not accepted (0 - unlimited).
+        // It is divided between threads.
+        size_t max_sessions;
+        // Maximal length of queue of connections, which are not accepted yet (capped by "net.core.somaxconn")
+        int backlog;
+        // Time to wait for PROXY header before connection is accepted (TCP_DEFER_ACCEPT, 0 - disabled)
+        TimingWheel::Duration tcp_defer_accept;
+        // Endpoint of metrics in Prometheus format: "ip:port" or "unix:/path" (not specified - disabled)
+        boost::optional<boost::asio::generic::stream_protocol::endpoint> stats_listen;
+        // Destination servers by original destination of visitors (section "routes").
+        // Visitors without route are connected to loopback on original port.
+        std::shared_ptr<const RoutingTable> routing_table;
+        // Unix domain socket, over which listening sockets are passed to a new instance on upgrade (empty - disabled)
+        std::string handoff_path;
+        // Binary file of sampled timelines of sessions (empty - disabled) and one of how many sessions is traced
+        std::string trace_file;
+        uint32_t trace_sample_rate;
+        // Delay of event loop, which is logged as a stall (0 - event loops are not watched)
+        std::chrono::steady_clock::duration stall_threshold;
+        // Consecutive failures to connect to destination server, after which sessions to it are rejected for
+        // cool-down (0 - never)
+        uint32_t circuit_breaker_failures;
+        std::chrono::steady_clock::duration circuit_breaker_cooldown;
+        // Limit of memory reserved by sessions and relay buffers, in bytes (0 - unlimited)
+        size_t memory_budget;
 
         Config(const boost::filesystem::path& filepath) {
             auto ini_file = IniFile::parse(filepath);
             listen = parse_to_ip_port(ini_file.get<std::string>("listen"));
-            mark = ini_file.get<int>("mark");
-            table = ini_file.get<int>("table");
+            transparent = ini_file.get<bool>("transparent", true);
+            mark = transparent ? ini_file.get<int>("mark") : ini_file.get<int>("mark", 0);
+            table = transparent ? ini_file.get<int>("table") : ini_file.get<int>("table", 0);
+            threads = ini_file.get<unsigned>("threads", 1);
+            if (threads == 0)
+                threads = std::max(std::thread::hardware_concurrency(), 1u);
+            auto cpu_affinity_str = ini_file.get<std::string>("cpu_affinity", "");
+            if (!cpu_affinity_str.empty())
+                cpu_affinity = CpuAffinity::parse_list(cpu_affinity_str);
+            relay = parse_relay(ini_file.get<std::string>("relay", "copy"));
+            buffer_pool_capacity = ini_file.get<size_t>("buffer_pool_capacity", 1024);
+            io_uring_buffers = ini_file.get<uint16_t>("io_uring_buffers", 256);
+            header_timeout = parse_duration(ini_file, "header_timeout", 60);
+            idle_timeout = parse_duration(ini_file, "idle_timeout", 0);
+            client_idle_timeout = parse_duration(ini_file, "client_idle_timeout", 0);
+            server_idle_timeout = parse_duration(ini_file, "server_idle_timeout", 0);
+            half_closed_timeout = parse_duration(ini_file, "half_closed_timeout", 0);
+            session_lifetime = parse_duration(ini_file, "session_lifetime", 0);
+            tcp_keepalive_time = parse_duration(ini_file, "tcp_keepalive_time", 0);
+            tcp_keepalive_interval = parse_duration(ini_file, "tcp_keepalive_interval", 0);
+            tcp_keepalive_probes = ini_file.get<int>("tcp_keepalive_probes", 0);
+            tcp_user_timeout = parse_duration(ini_file, "tcp_user_timeout", 0);
+            tcp_fastopen_connect = ini_file.get<bool>("tcp_fastopen_connect", false);
+            max_connections_per_ip = ini_file.get<uint32_t>("max_connections_per_ip", 0);
+            connect_rate_per_ip = ini_file.get<double>("connect_rate_per_ip", 0);
+            connect_burst_per_ip = ini_file.get<double>("connect_burst_per_ip", std::max(connect_rate_per_ip, 1.0));
+            if (connect_rate_per_ip < 0 || connect_burst_per_ip < 1)
+                throw std::runtime_error("Options 'connect_rate_per_ip' and 'connect_burst_per_ip' must not be negative"
+                                         " and bucket must hold at least one connection");
+            admission_table_size = ini_file.get<size_t>("admission_table_size", 65536);
+            max_sessions = ini_file.get<size_t>("max_sessions", 0);
+            backlog = ini_file.get<int>("backlog", static_cast<int>(boost::asio::socket_base::max_listen_connections));
+            tcp_defer_accept = parse_duration(ini_file, "tcp_defer_accept", 5);
+            auto stats_listen_str = ini_file.get<std::string>("stats_listen", "");
+            if (!stats_listen_str.empty())
+                stats_listen = parse_stats_listen(stats_listen_str);
+            handoff_path = ini_file.get<std::string>("handoff_path", "");
+            trace_file = ini_file.get<std::string>("trace_file", "");
+            trace_sample_rate = ini_file.get<uint32_t>("trace_sample_rate", 100);
+            if (trace_sample_rate == 0)
+                throw std::runtime_error("Option 'trace_sample_rate' must be positive");
+            stall_threshold = parse_duration(ini_file, "stall_threshold", 0.1);
+            circuit_breaker_failures = ini_file.get<uint32_t>("circuit_breaker_failures", 0);
+            circuit_breaker_cooldown = parse_duration(ini_file, "circuit_breaker_cooldown", 5);
+            // Specified in megabytes
+            memory_budget = ini_file.get<size_t>("memory_budget", 0) * 1024 * 1024;
+            routing_table = parse_routing_table(ini_file);
+        }
+
+        static std::shared_ptr<const RoutingTable> parse_routing_table(const boost::property_tree::ptree& ini_file) {
+            return std::make_shared<RoutingTable>(
+                RoutingTable::parse(ini_file.get_child("routes", boost::property_tree::ptree())));
+        }
+
+    private:
+        // Duration is specified in seconds (fractional part is allowed)
+        static TimingWheel::Duration parse_duration(
+            const boost::property_tree::ptree& ini_file,
+            const char* key,
+            double default_seconds)
+        {
+            auto seconds = ini_file.get<double>(key, default_seconds);
+            if (seconds < 0)
+                throw std::runtime_error(std::string("Option '") + key + "' must not be negative");
+            return std::chrono::duration_cast<TimingWheel::Duration>(std::chrono::duration<double>(seconds));
+        }
+
+        static boost::asio::generic::stream_protocol::endpoint parse_stats_listen(const std::string& str) {
+            static const boost::string_view kUnixPrefix = "unix:";
+            if (boost::string_view(str).starts_with(kUnixPrefix))
+                return boost::asio::local::stream_protocol::endpoint(str.substr(kUnixPrefix.size()));
+            return parse_to_ip_port(str);
+        }
+
+        static Relay parse_relay(const std::string& str) {
+            if (str == "copy")
+                return Relay::Copy;
+            if (str == "splice")
+                return Relay::Splice;
+            if (str == "io_uring")
+                return Relay::IoUring;
+            if (str == "sockmap")
+                return Relay::Sockmap;
+            throw std::runtime_error(
+                "'" + str + "' is not a relay engine (expected 'copy', 'splice', 'io_uring' or 'sockmap')");
         }
     };
 
+    // Client connection and connection to destination server. Session is shared by coroutines of both directions
+    // and is deleted, when both of them are finished.
     class Session : public boost::noncopyable
     {
-    private:
+    public:
+        enum Direction {
+            // From client to destination server
+            Upstream,
+            // From destination server to client
+            Downstream
+        };
+
+        // Reason of forced closing of session
+        enum class ReapReason {
+            HeaderTimeout,
+            IdleTimeout,
+            ClientIdleTimeout,
+            ServerIdleTimeout,
+            HalfClosedTimeout,
+            LifetimeTimeout,
+            // Connection is broken according to TCP keepalive or TCP_USER_TIMEOUT
+            DeadPeer,
+            // The newest sessions are closed, when memory budget is exceeded
+            MemoryPressure,
+            kReasonsNumber
+        };
+
         using CounterT = size_t;
-        static std::atomic<CounterT> m_total_objects;
-        static std::atomic<CounterT> m_next_id;
 
     private:
         const CounterT m_id;
+        SessionTimeline m_timeline;
+        const Config& m_config;
+        TimingWheel& m_timing_wheel;
+        boost::asio::ip::tcp::socket m_peer_sock;
+        boost::asio::ip::tcp::socket m_ds_sock;
+        TimingWheel::Timer m_idle_timer;
+        TimingWheel::Timer m_client_idle_timer;
+        TimingWheel::Timer m_server_idle_timer;
+        TimingWheel::Timer m_half_closed_timer;
+        TimingWheel::Timer m_lifetime_timer;
+        boost::optional<ReapReason> m_reap_reason;
+        // Counts the session in the limits of its source IP
+        AdmissionControl::Ticket m_admission_ticket;
+#ifdef PROGDN_RVI_SOCKMAP
+        // Sockets relayed by the kernel and bytes relayed in each direction, which were seen by idle timeouts
+        Sockmap::Pair m_sockmap_pair;
+        uint64_t m_redirected_bytes[2] = {};
+#endif
+        // Sessions of this thread (i.e. of its server)
+        static thread_local CounterT m_thread_objects;
 
     public:
-        Session() : m_id(m_next_id.fetch_add(1)) {
-            ++m_total_objects;
-            if (Log::is_enabled())
-                Log::debug(boost::format("Created session #%1% (total: %2%)") % m_id % m_total_objects);
+        Session(
+            CounterT id,
+            const Config& config,
+            boost::asio::io_context& io_context,
+            TimingWheel& timing_wheel,
+            boost::asio::ip::tcp::socket&& peer_sock) :
+            m_id(id),
+            m_config(config),
+            m_timing_wheel(timing_wheel),
+            m_peer_sock(std::move(peer_sock)),
+            m_ds_sock(io_context),
+            m_idle_timer([this]() { on_idle_timeout(m_idle_timer, ReapReason::IdleTimeout); }),
+            m_client_idle_timer([this]() { on_idle_timeout(m_client_idle_timer, ReapReason::ClientIdleTimeout); }),
+            m_server_idle_timer([this]() { on_idle_timeout(m_server_idle_timer, ReapReason::ServerIdleTimeout); }),
+            m_half_closed_timer([this]() { reap(ReapReason::HalfClosedTimeout); }),
+            m_lifetime_timer([this]() { reap(ReapReason::LifetimeTimeout); })
+        {
+            m_timeline.mark(SessionTimeline::Accepted);
+            metrics::add(metrics::Gauge::ActiveSessions, 1);
+            ++m_thread_objects;
+            PROGDN_LOG_DEBUG("Created session #", m_id, " (sessions of thread: ", m_thread_objects, ')');
         }
 
         ~Session() {
-            --m_total_objects;
-            if (Log::is_enabled())
-                Log::debug(boost::format("Deleted session %1% (total: %2%)") % m_id % m_total_objects);
+            metrics::add(metrics::Gauge::ActiveSessions, -1);
+            --m_thread_objects;
+            m_timeline.mark(SessionTimeline::Closed);
+#ifdef PROGDN_RVI_SOCKMAP
+            if (m_sockmap_pair.is_inserted()) {
+                metrics::add(metrics::Counter::BytesUpstream, m_sockmap_pair.redirected_bytes(Upstream));
+                metrics::add(metrics::Counter::BytesDownstream, m_sockmap_pair.redirected_bytes(Downstream));
+            }
+#endif
+            metrics::observe(metrics::Histogram::SessionDuration, std::chrono::duration_cast<metrics::Duration>(
+                m_timeline.elapsed(SessionTimeline::Accepted, SessionTimeline::Closed)));
+            const auto& trace = SessionTrace::get_instance_or_null();
+            if (trace && trace->is_sampled())
+                trace->write(m_id, m_timeline,
+                             m_reap_reason ? static_cast<uint8_t>(*m_reap_reason) : TraceRecord::kNotReaped);
+            PROGDN_LOG_DEBUG("Deleted session #", m_id, " (sessions of thread: ", m_thread_objects, ')');
         }
 
     public:
-        std::string name_as_prefix() const {
-            return "[Session #" + std::to_string(id()) + "] ";
+        // Prefix of log records of the session
+        struct LogPrefix {
+            CounterT id;
+
+            void append_to(Log::Record& record) const noexcept {
+                record.append("[Session #").append(id).append("] ");
+            }
+        };
+
+        LogPrefix log_prefix() const noexcept {
+            return LogPrefix{m_id};
         }
 
         CounterT id() const noexcept {
             return m_id;
         }
 
+        boost::asio::ip::tcp::socket& peer_sock() noexcept {
+            return m_peer_sock;
+        }
+
+        boost::asio::ip::tcp::socket& ds_sock() noexcept {
+            return m_ds_sock;
+        }
+
+        AdmissionControl::Ticket& admission_ticket() noexcept {
+            return m_admission_ticket;
+        }
+
+        SessionTimeline& timeline() noexcept {
+            return m_timeline;
+        }
+
+#ifdef PROGDN_RVI_SOCKMAP
+        // Pair of sockets in sockmap (first - client's socket)
+        Sockmap::Pair& sockmap_pair() noexcept {
+            return m_sockmap_pair;
+        }
+#endif
+
+        // Starts timeouts of transmission of payload
+        void start_timeouts() {
+            rearm(Upstream);
+            rearm(Downstream);
+            arm(m_lifetime_timer, m_config.session_lifetime);
+        }
+
+        // Called on transmission of payload
+        void on_activity(Direction direction) {
+            auto first_byte = (direction == Upstream)
+                ? SessionTimeline::FirstUpstreamByte
+                : SessionTimeline::FirstDownstreamByte;
+            if (!m_timeline.is_marked(first_byte)) {
+                m_timeline.mark(first_byte);
+                if (direction == Downstream)
+                    metrics::observe(
+                        metrics::Histogram::FirstResponseByte,
+                        std::chrono::duration_cast<metrics::Duration>(
+                            m_timeline.elapsed(SessionTimeline::Connected, SessionTimeline::FirstDownstreamByte)));
+            }
+            rearm(direction);
+        }
+
+        // Called, when there is no more payload in the direction (session becomes half-closed)
+        void on_end_of_payload(Direction direction) {
+            (direction == Upstream ? m_client_idle_timer : m_server_idle_timer).cancel();
+            if (!m_half_closed_timer.is_armed())
+                arm(m_half_closed_timer, m_config.half_closed_timeout);
+        }
+
+        // Closes both connections (only once), so transmission in both directions is aborted
+        void reap(ReapReason reason) noexcept {
+            if (m_reap_reason)
+                return;
+            m_reap_reason = reason;
+            metrics::add(metrics::Counter::ReapedSessions + static_cast<size_t>(reason));
+            PROGDN_LOG_INFO(log_prefix(), "Closing: ", to_string(reason));
+            // Shutdown wakes up operations of io_uring, which are not cancelled by closing
+            boost::system::error_code error;
+            m_peer_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
+            m_ds_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
+            m_peer_sock.close(error);
+            m_ds_sock.close(error);
+        }
+
+        // Reason, by which session was closed (if it was)
+        const boost::optional<ReapReason>& reap_reason() const noexcept {
+            return m_reap_reason;
+        }
+
+        // Sums metrics of all threads under a lock, so it is not used for each session
         static CounterT total_objects() noexcept {
-            return m_total_objects;
+            return static_cast<CounterT>(std::max<int64_t>(metrics::value(metrics::Gauge::ActiveSessions), 0));
+        }
+
+        static CounterT thread_objects() noexcept {
+            return m_thread_objects;
+        }
+
+        static uint64_t total_reaped(ReapReason reason) noexcept {
+            return metrics::value(metrics::Counter::ReapedSessions + static_cast<size_t>(reason));
+        }
+
+        // Memory reserved by a session besides relay buffers (they are accounted by the pool), estimated:
+        // the object, frames of its coroutines (with buffer of PROXY header) and kernel state of its sockets
+        // (and pipes of relay "splice"). Data queued in sockets is limited by the kernel and is not included.
+        static size_t estimated_size(const Config& config) noexcept {
+            static const size_t kCoroutineFramesSize = 2048 + haproxy_protocol::kMaximalHeaderSize;
+            static const size_t kSocketSize = 3072;
+            static const size_t kPipeSize = 2048;
+            auto size = sizeof(Session) + kCoroutineFramesSize + 2 * kSocketSize;
+            if (config.relay == Config::Relay::Splice)
+                size += 2 * kPipeSize;
+            return size;
+        }
+
+        static const char* to_string(ReapReason reason) noexcept {
+            auto index = static_cast<size_t>(reason);
+            return (index < kReapReasonsNumber) ? kReapReasons[index] : "???";
+        }
+
+    private:
+        // Payload relayed by the kernel is not seen by the session, so counters of the kernel are checked before
+        // the session is closed
+        void on_idle_timeout(TimingWheel::Timer& timer, ReapReason reason) {
+#ifdef PROGDN_RVI_SOCKMAP
+            if (m_sockmap_pair.is_inserted()) {
+                for (auto direction : { Upstream, Downstream }) {
+                    auto bytes = m_sockmap_pair.redirected_bytes(direction);
+                    if (bytes != m_redirected_bytes[direction]) {
+                        m_redirected_bytes[direction] = bytes;
+                        rearm(direction);
+                    }
+                }
+                if (timer.is_armed())
+                    return;
+            }
+#endif
+            reap(reason);
+        }
+
+        void rearm(Direction direction) {
+            arm(m_idle_timer, m_config.idle_timeout);
+            if (direction == Upstream)
+                arm(m_client_idle_timer, m_config.client_idle_timeout);
+            else
+                arm(m_server_idle_timer, m_config.server_idle_timeout);
+        }
+
+        // Zero timeout is unlimited
+        void arm(TimingWheel::Timer& timer, TimingWheel::Duration timeout) {
+            if (timeout.count() > 0)
+                m_timing_wheel.arm(timer, timeout);
         }
     };
-    std::atomic<Session::CounterT> Session::m_total_objects(0);
-    std::atomic<Session::CounterT> Session::m_next_id(1);
+    thread_local Session::CounterT Session::m_thread_objects = 0;
+
+    static_assert(static_cast<size_t>(Session::ReapReason::kReasonsNumber)
+                  == static_cast<size_t>(metrics::Counter::ReapedSessionsEnd)
+                     - static_cast<size_t>(metrics::Counter::ReapedSessions),
+                  "Reaped sessions are counted by reason");
+    static_assert(static_cast<size_t>(Session::ReapReason::kReasonsNumber) == kReapReasonsNumber,
+                  "Every reason of reaping has a name");
 
+    // Each server owns an event loop and an acceptor. Several servers (one per thread) share the same listening
+    // address via SO_REUSEPORT, so the kernel balances connections between them and every session stays within
+    // a thread, which accepted it. Server has more acceptors, when previous instance handed over more sockets
+    // than there are threads (each socket of the group receives connections, so each one must be served).
     class Server : public std::enable_shared_from_this<Server>
     {
+    public:
+        // Size of buffers provided to io_uring
+        static const size_t kIoUringBufferSize = 16 * 1024;
+
     private:
         std::shared_ptr<Config> m_config;
+        // Accessed from the thread of own io_context only
         bool m_is_shutdown_requested = false;
         std::shared_ptr<boost::asio::io_context> m_io_context;
-        boost::asio::ip::tcp::acceptor m_acceptor;
+        // Replaced on reload of configuration; sessions keep destinations, to which they are connected
+        std::shared_ptr<const RoutingTable> m_routing_table;
+        // Limits per source IP shared by all servers (null, when they are disabled)
+        std::shared_ptr<AdmissionControl> m_admission_control;
+        // Availability of destination servers shared by all servers (null, when it is disabled)
+        std::shared_ptr<CircuitBreaker> m_circuit_breaker;
+        // Memory reserved by sessions of all servers (null, when it is unlimited)
+        std::shared_ptr<MemoryBudget> m_memory_budget;
+        // Sessions of this server in order of creation (tracked only with memory budget, so the newest ones are
+        // closed under memory pressure). Sessions are kept alive by their coroutines, while they are in the list.
+        std::list<Session*> m_sessions;
+        // Elements are referenced by coroutines, which accept connections
+        std::list<boost::asio::ip::tcp::acceptor> m_acceptors;
+        // Timeouts of sessions of this event loop
+        TimingWheel m_timing_wheel;
+        // Share of "max_sessions" (0 - unlimited)
+        const size_t m_max_sessions;
+        // Released, when the limit of open files is reached
+        ReserveDescriptor m_reserve_fd;
+        std::chrono::steady_clock::time_point m_overload_warning_time;
+        // Stalls of the event loop since the last warning about them
+        std::chrono::steady_clock::time_point m_stall_warning_time;
+        uint64_t m_unreported_stalls = 0;
+        // Identifiers of sessions are unique across servers: they are interleaved by number of servers
+        Session::CounterT m_next_session_id;
+        const Session::CounterT m_session_id_step;
+        // CPU, to which the thread of the event loop is pinned (-1 - not pinned)
+        const int m_cpu;
+#ifdef PROGDN_RVI_IO_URING
+        // Relay engine "io_uring" (not created, when it is not supported by the kernel).
+        // Buffers are deleted after the ring, since the kernel may write into them until the ring is closed.
+        std::unique_ptr<IoUring::BufferGroup> m_io_uring_buffers;
+        std::unique_ptr<IoUring> m_io_uring;
+#endif
+#ifdef PROGDN_RVI_SOCKMAP
+        // Relay engine "sockmap" (not created, when BPF programs cannot be loaded)
+        std::shared_ptr<Sockmap> m_sockmap;
+#endif
 
     public:
         Server(
             const std::shared_ptr<Config>& config,
-            const std::shared_ptr<boost::asio::io_context>& io_context) :
+            const std::shared_ptr<boost::asio::io_context>& io_context,
+            const std::shared_ptr<AdmissionControl>& admission_control,
+            const std::shared_ptr<CircuitBreaker>& circuit_breaker,
+            const std::shared_ptr<MemoryBudget>& memory_budget,
+            unsigned index) :
             m_config(config),
             m_io_context(io_context),
-            m_acceptor(*m_io_context) {
+            m_routing_table(config->routing_table),
+            m_admission_control(admission_control),
+            m_circuit_breaker(circuit_breaker),
+            m_memory_budget(memory_budget),
+            m_timing_wheel(*m_io_context),
+            m_max_sessions((config->max_sessions + config->threads - 1) / config->threads),
+            m_next_session_id(index + 1),
+            m_session_id_step(config->threads),
+            m_cpu(config->cpu_affinity.empty()
+                  ? -1 : static_cast<int>(config->cpu_affinity[index % config->cpu_affinity.size()])) {
+            if (m_config->relay == Config::Relay::IoUring)
+                init_io_uring();
+            if (m_config->relay == Config::Relay::Sockmap)
+                init_sockmap();
+            if (auto error = m_reserve_fd.open())
+                throw std::runtime_error(std::string("Cannot open reserve descriptor: ") + strerror(error));
         }
 
     public:
-        void start(const boost::asio::ip::tcp::endpoint& listen) {
-            Log::info("Listen: " + listen.address().to_string() + ':' + std::to_string(listen.port()));
-            m_acceptor.open(boost::asio::ip::tcp::v4());
-            // Option "reuse address" must be set in order to allow second instance after shutdown this one
-            m_acceptor.set_option(boost::asio::ip::tcp::socket::reuse_address(true));
-            m_acceptor.bind(listen);
-            m_acceptor.listen();
-            boost::asio::spawn(*m_io_context, std::bind(&Server::accept, shared_from_this(), std::placeholders::_1));
+        // Serves listening sockets taken from previous instance (they keep connections waiting in accept queue)
+        // or, when there are none, binds a new one
+        void start(const boost::asio::ip::tcp::endpoint& listen, const std::vector<int>& inherited_fds) {
+            for (auto fd : inherited_fds) {
+                PROGDN_LOG_INFO("Listen: ", listen, " (taken from running instance)");
+                m_acceptors.emplace_back(*m_io_context, boost::asio::ip::tcp::v4(), fd);
+            }
+            if (inherited_fds.empty()) {
+                PROGDN_LOG_INFO("Listen: ", listen);
+                m_acceptors.emplace_back(*m_io_context);
+                auto& acceptor = m_acceptors.back();
+                acceptor.open(boost::asio::ip::tcp::v4());
+                // Option "reuse address" must be set in order to allow second instance after shutdown this one
+                acceptor.set_option(boost::asio::ip::tcp::socket::reuse_address(true));
+                // Option "reuse port" allows each event loop to have own acceptor bound to the same address
+                int reuse_port = 1;
+                if (::setsockopt(acceptor.native_handle(), SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) < 0)
+                    throw std::runtime_error(std::string("Cannot set SO_REUSEPORT for the listening socket: ") + strerror(errno));
+                acceptor.bind(listen);
+            }
+            for (auto& acceptor : m_acceptors) {
+                // Connection is accepted only when its first data (PROXY header) arrives, so the session does not
+                // wake up just to wait for it. Options are applied to inherited sockets too (listen() again
+                // changes backlog of a listening socket).
+                if (m_config->tcp_defer_accept.count() > 0) {
+                    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(m_config->tcp_defer_accept);
+                    int value = std::max<int>(seconds.count(), 1);
+                    if (::setsockopt(acceptor.native_handle(), IPPROTO_TCP, TCP_DEFER_ACCEPT, &value, sizeof(value)) < 0)
+                        throw std::runtime_error(std::string("Cannot set TCP_DEFER_ACCEPT for the listening socket: ") + strerror(errno));
+                }
+                // Connection is accepted by the thread on the CPU, which processed its SYN (when there is one), so
+                // packets and the session are handled by the same CPU (Linux 6.1 or newer; SYNs on other CPUs are
+                // balanced by hash, as without the option)
+                if (m_cpu >= 0) {
+                    if (::setsockopt(acceptor.native_handle(), SOL_SOCKET, SO_INCOMING_CPU, &m_cpu, sizeof(m_cpu)) < 0)
+                        throw std::runtime_error(std::string("Cannot set SO_INCOMING_CPU for the listening socket: ") + strerror(errno));
+                }
+                acceptor.listen(m_config->backlog);
+                // Otherwise accept() waits for the next connection (blocking the event loop), when a connection is
+                // aborted by client before it is accepted
+                acceptor.set_option(boost::asio::socket_base::enable_connection_aborted(true));
+                boost::asio::co_spawn(*m_io_context, accept(shared_from_this(), acceptor), boost::asio::detached);
+            }
+            if (m_config->stall_threshold.count() > 0)
+                boost::asio::co_spawn(*m_io_context, watch_event_loop(shared_from_this()), boost::asio::detached);
+            if (m_memory_budget)
+                boost::asio::co_spawn(*m_io_context, watch_memory(shared_from_this()), boost::asio::detached);
+        }
+
+        // Descriptors of listening sockets (to be handed over to a new instance)
+        std::vector<int> listening_fds() {
+            std::vector<int> fds;
+            for (auto& acceptor : m_acceptors)
+                fds.push_back(acceptor.native_handle());
+            return fds;
         }
 
     private:
-        void accept(boost::asio::yield_context yield)
+        // Server is kept alive by the coroutine until acceptor is closed
+        // Connections are accepted until the queue is empty, so a burst of connections costs one wakeup.
+        // Accepting is paused, while the limit of sessions or the limit of open files is reached, or memory budget
+        // is nearly spent (connections wait in the queue meanwhile).
+        static Awaitable<> accept(std::shared_ptr<Server> self, boost::asio::ip::tcp::acceptor& acceptor)
         {
-            auto& io_context = *m_io_context;
-            boost::asio::ip::tcp::socket client(io_context);
+            // Other events of the loop are not delayed for long by a huge burst
+            static const size_t kMaximalBatchSize = 256;
+            // Limits of sessions and of memory are checked this often, while they are reached
+            static const std::chrono::milliseconds kSessionsCheckPeriod(10);
+            // Pause after failure because of the limit of open files grows, while failures repeat
+            static const std::chrono::milliseconds kMinimalBackoff(10);
+            static const std::chrono::milliseconds kMaximalBackoff(1000);
+
+            auto& io_context = *self->m_io_context;
+            acceptor.non_blocking(true);
+            boost::asio::steady_timer pause_timer(io_context);
+            auto backoff = kMinimalBackoff;
+            while (!self->m_is_shutdown_requested)
+            {
+                boost::system::error_code error;
+                if (self->is_sessions_limit_reached()) {
+                    metrics::add(metrics::Counter::AcceptsThrottledBySessions);
+                    metrics::add(metrics::Gauge::PausedAcceptors, 1);
+                    self->warn_of_overload("Limit of sessions is reached, accepting is paused");
+                    while (self->is_sessions_limit_reached() && !self->m_is_shutdown_requested) {
+                        pause_timer.expires_after(kSessionsCheckPeriod);
+                        co_await pause_timer.async_wait(with_error(error));
+                    }
+                    metrics::add(metrics::Gauge::PausedAcceptors, -1);
+                    continue;
+                }
+                if (self->is_memory_saturated()) {
+                    metrics::add(metrics::Counter::AcceptsThrottledByMemory);
+                    metrics::add(metrics::Gauge::PausedAcceptors, 1);
+                    self->warn_of_overload("Memory budget is nearly spent, accepting is paused");
+                    while (self->is_memory_saturated() && !self->m_is_shutdown_requested) {
+                        pause_timer.expires_after(kSessionsCheckPeriod);
+                        co_await pause_timer.async_wait(with_error(error));
+                    }
+                    metrics::add(metrics::Gauge::PausedAcceptors, -1);
+                    continue;
+                }
+
+                co_await acceptor.async_wait(boost::asio::ip::tcp::acceptor::wait_read, with_error(error));
+                size_t accepted_number = 0;
+                for (; !error && accepted_number < kMaximalBatchSize && !self->is_sessions_limit_reached()
+                       && !self->is_memory_saturated(); ++accepted_number) {
+                    boost::asio::ip::tcp::socket client(io_context);
+                    acceptor.accept(client, error);
+                    if (!error)
+                        self->start_session(std::move(client));
+                    // Connection was reset by client while it waited in the queue: the next one is taken
+                    else if (error == boost::asio::error::connection_aborted || error.value() == EPROTO)
+                        error.clear();
+                }
+                if (accepted_number > 0)
+                    backoff = kMinimalBackoff;
+                if (error == boost::asio::error::no_descriptors || error.value() == ENFILE) {
+                    metrics::add(metrics::Counter::AcceptsThrottledByOpenFiles);
+                    if (self->m_reserve_fd.shed_connection(acceptor.native_handle()))
+                        metrics::add(metrics::Counter::ShedConnections);
+                    metrics::add(metrics::Gauge::PausedAcceptors, 1);
+                    self->warn_of_overload("Limit of open files is reached, accepting is paused for ",
+                                           backoff.count(), " ms");
+                    pause_timer.expires_after(backoff);
+                    co_await pause_timer.async_wait(with_error(error));
+                    metrics::add(metrics::Gauge::PausedAcceptors, -1);
+                    backoff = std::min(backoff * 2, kMaximalBackoff);
+                } else if (error
+                    && error != boost::asio::error::would_block
+                    && error != boost::asio::error::try_again
+                    && error != boost::asio::error::operation_aborted) {
+                    metrics::add(metrics::Counter::AcceptErrors);
+                    PROGDN_LOG_ERROR("Cannot accept client: ", error);
+                }
+            }
+        }
+
+        // Any blocking call delays all sessions of the thread, so the loop is probed periodically: delay of the probe
+        // is the time, for which the loop was busy with other work (probes stop with accepting, so the loop can finish)
+        static Awaitable<> watch_event_loop(std::shared_ptr<Server> self)
+        {
+            // Stall is detected, when it is longer than the interval (it delays the next probe anyway)
+            static const std::chrono::milliseconds kProbeInterval(10);
+            static const std::chrono::seconds kWarningPeriod(1);
 
+            boost::asio::steady_timer timer(*self->m_io_context);
             boost::system::error_code error;
-            m_acceptor.async_accept(client, yield[error]);
-            if (!m_is_shutdown_requested)
-                boost::asio::spawn(io_context, std::bind(&Server::accept, shared_from_this(), std::placeholders::_1));
-            if (error) {
-                if (Log::is_enabled() && error != boost::asio::error::operation_aborted)
-                    Log::error("Cannot accept client: " + error.message());
+            while (!self->m_is_shutdown_requested)
+            {
+                timer.expires_after(kProbeInterval);
+                co_await timer.async_wait(with_error(error));
+                auto now = std::chrono::steady_clock::now();
+                auto lag = std::max(now - timer.expiry(), std::chrono::steady_clock::duration::zero());
+                metrics::observe(metrics::Histogram::EventLoopLag, std::chrono::duration_cast<metrics::Duration>(lag));
+                if (lag < self->m_config->stall_threshold)
+                    continue;
+                metrics::add(metrics::Counter::EventLoopStalls);
+                // Stalls may repeat on every probe, so the log is not flooded
+                ++self->m_unreported_stalls;
+                if (now - self->m_stall_warning_time < kWarningPeriod)
+                    continue;
+                PROGDN_LOG_WARNING("Event loop was stalled for ",
+                                   std::chrono::duration_cast<std::chrono::milliseconds>(lag).count(), " ms (stalls: ",
+                                   self->m_unreported_stalls, " since the last warning)");
+                self->m_stall_warning_time = now;
+                self->m_unreported_stalls = 0;
+            }
+        }
+
+        // Usage of memory is recomputed periodically, and each server responds to its level: frees own free buffers,
+        // and closes its share of sessions (the newest ones), which do not fit into the budget. Accepting and
+        // enlarging of relay buffers check the level by themselves.
+        static Awaitable<> watch_memory(std::shared_ptr<Server> self)
+        {
+            static const std::chrono::milliseconds kCheckPeriod(50);
+            // Sessions closed by a server at once (closing frees memory only after their coroutines finish)
+            static const size_t kMaximalShedBatchSize = 256;
+
+            auto& budget = *self->m_memory_budget;
+            boost::asio::steady_timer timer(*self->m_io_context);
+            boost::system::error_code error;
+            while (!self->m_is_shutdown_requested)
+            {
+                timer.expires_after(kCheckPeriod);
+                co_await timer.async_wait(with_error(error));
+                if (budget.update(Session::total_objects()))
+                    PROGDN_LOG_WARNING("Memory usage: ", budget.usage() / 1024, " KB of ", budget.budget() / 1024,
+                                       " KB, level of pressure: ", MemoryBudget::to_string(budget.level()));
+                auto level = budget.level();
+                if (level >= MemoryBudget::Level::Constrained)
+                    BufferPool::release_free_buffers();
+                if (level == MemoryBudget::Level::Exceeded) {
+                    // Sessions closed by previous checks may still be counted, until their coroutines finish
+                    auto threads = self->m_config->threads;
+                    auto shed_number = std::min((budget.excess_sessions() + threads - 1) / threads,
+                                                kMaximalShedBatchSize);
+                    for (auto it = self->m_sessions.rbegin(); it != self->m_sessions.rend() && shed_number > 0; ++it) {
+                        auto reap_reason = (*it)->reap_reason();
+                        if (!reap_reason)
+                            (*it)->reap(Session::ReapReason::MemoryPressure);
+                        if (!reap_reason || *reap_reason == Session::ReapReason::MemoryPressure)
+                            --shed_number;
+                    }
+                }
+            }
+        }
+
+        bool is_sessions_limit_reached() const noexcept {
+            return (m_max_sessions > 0 && Session::thread_objects() >= m_max_sessions);
+        }
+
+        bool is_memory_saturated() const noexcept {
+            return (m_memory_budget && m_memory_budget->level() >= MemoryBudget::Level::Saturated);
+        }
+
+        // Overload may last long, so the log is not flooded (pauses are counted by metrics anyway)
+        template<typename... Arguments>
+        void warn_of_overload(const Arguments&... arguments) noexcept {
+            static const std::chrono::seconds kWarningPeriod(1);
+            auto now = std::chrono::steady_clock::now();
+            if (now - m_overload_warning_time < kWarningPeriod)
                 return;
+            m_overload_warning_time = now;
+            PROGDN_LOG_WARNING(arguments...);
+        }
+
+        void start_session(boost::asio::ip::tcp::socket&& client) noexcept
+        {
+            metrics::add(metrics::Counter::AcceptedConnections);
+            try {
+                auto session_id = m_next_session_id;
+                m_next_session_id += m_session_id_step;
+                auto session = std::make_shared<Session>(
+                    session_id, *m_config, *m_io_context, m_timing_wheel, std::move(client));
+                boost::asio::co_spawn(*m_io_context, serve_session(shared_from_this(), session), boost::asio::detached);
+            } catch (...) {
             }
+        }
 
+        static Awaitable<> serve_session(std::shared_ptr<Server> self, std::shared_ptr<Session> session)
+        {
+            auto session_it = self->m_sessions.end();
             try {
-                Session session;
-                try {
-                    serve(session, client, yield);
-                } catch (const std::exception& e) {
-                    if (Log::is_enabled())
-                        Log::error(session.name_as_prefix() + "Interrupted: " + e.what());
-                }
+                if (self->m_memory_budget)
+                    session_it = self->m_sessions.insert(self->m_sessions.end(), session.get());
+                co_await self->serve(session);
+            } catch (const std::exception& e) {
+                PROGDN_LOG_ERROR(session->log_prefix(), "Interrupted: ", e.what());
             } catch (...) {
             }
+            if (session_it != self->m_sessions.end())
+                self->m_sessions.erase(session_it);
         }
 
-        void serve(const Session& session, boost::asio::ip::tcp::socket& peer_sock, boost::asio::yield_context& yield)
+        Awaitable<> serve(const std::shared_ptr<Session>& session)
         {
-            auto gen_log_prefix = [&session]() { return session.name_as_prefix(); };
-            if (Log::is_enabled())
-                Log::info(gen_log_prefix() + "Initiator: " + get_string_remote_endpoint(peer_sock));
+            auto& peer_sock = session->peer_sock();
+            PROGDN_LOG_INFO(session->log_prefix(), "Initiator: ", peer_sock.remote_endpoint());
+            set_keepalive(peer_sock);
 
             std::string error_text;
-            std::array<char, haproxy_protocol::tcp4::kMaximalHeaderSize> buffer;
-            auto recv_result = recv_proxy_header(peer_sock, yield, buffer, Log::is_enabled() ? &error_text : nullptr);
+            std::array<char, haproxy_protocol::kMaximalHeaderSize> buffer;
+            auto recv_result = co_await recv_proxy_header(
+                *session, buffer, Log::is_enabled(Log::Error) ? &error_text : nullptr);
             const auto& proxy_header = recv_result.first;
             if (!proxy_header.is_initialized()) {
-                if (Log::is_enabled())
-                    Log::error(gen_log_prefix() + "Cannot receive proxy header: " + error_text);
-                return;
+                PROGDN_LOG_ERROR(session->log_prefix(), "Cannot receive proxy header: ", error_text);
+                co_return;
             }
             const auto& payload = recv_result.second;
+            auto& timeline = session->timeline();
+            timeline.mark(SessionTimeline::HeaderReceived);
+            metrics::observe(metrics::Histogram::HeaderWait, std::chrono::duration_cast<metrics::Duration>(
+                timeline.elapsed(SessionTimeline::Accepted, SessionTimeline::HeaderReceived)));
 
-            auto& io_context = peer_sock.get_executor().context();
-            boost::asio::ip::tcp::socket ds_sock(io_context, boost::asio::ip::tcp::v4());
-            auto set_ds_sock_opt_int = [&ds_sock](int level, int optname, int optvalue) {
-                if (::setsockopt(ds_sock.native_handle(), level, optname, &optvalue, sizeof(optvalue)) < 0) {
-                    auto error = errno;
-                    throw std::runtime_error("Cannot set option " + std::to_string(optname)
-                                             + " to value " + std::to_string(optvalue)
-                                             + " for the socket: " + strerror(error)
-                                             + (error == EPERM ? " (need to be root)" : ""));
+            // Connection of the proxy itself (health check) has no visitor and no destination: it is closed
+            // gracefully, so the check sees the server alive
+            if (proxy_header->is_local) {
+                metrics::add(metrics::Counter::LocalConnections);
+                PROGDN_LOG_INFO(session->log_prefix(), "Local connection of the proxy (health check), closing");
+                boost::system::error_code error;
+                peer_sock.shutdown(boost::asio::socket_base::shutdown_send, error);
+                co_return;
+            }
+
+            // Source is checked before connection to destination server is made
+            if (m_admission_control) {
+                auto verdict = m_admission_control->admit(proxy_header->src_ip, session->admission_ticket());
+                if (verdict == AdmissionControl::Verdict::TooManyConnections
+                    || verdict == AdmissionControl::Verdict::RateLimited) {
+                    metrics::add(verdict == AdmissionControl::Verdict::TooManyConnections
+                                 ? metrics::Counter::AdmissionRejectedByConnections
+                                 : metrics::Counter::AdmissionRejectedByRate);
+                    PROGDN_LOG_INFO(session->log_prefix(), "Rejected ", proxy_header->src_ip, ": ",
+                                    AdmissionControl::to_string(verdict));
+                    co_return;
                 }
+                if (verdict == AdmissionControl::Verdict::Untracked)
+                    metrics::add(metrics::Counter::AdmissionUntracked);
+            }
+
+            auto& io_context = *m_io_context;
+            auto is_ipv6 = proxy_header->src_ip.is_v6();
+            auto dst_endpoint = m_routing_table->route(proxy_header->dst_ip, proxy_header->dst_port);
+            if (!dst_endpoint) {
+                auto dst_ip = is_ipv6
+                    ? boost::asio::ip::address(boost::asio::ip::address_v6::loopback())
+                    : boost::asio::ip::address(boost::asio::ip::address_v4::loopback());
+                dst_endpoint.emplace(dst_ip, proxy_header->dst_port);
+            }
+            // Client of unavailable destination server is reset at once, so it may retry elsewhere without waiting
+            // for the connection to fail
+            CircuitBreaker::Attempt connect_attempt;
+            if (m_circuit_breaker) {
+                if (!m_circuit_breaker->allow(*dst_endpoint, connect_attempt)) {
+                    metrics::add(metrics::Counter::DestinationUnavailable);
+                    PROGDN_LOG_INFO(session->log_prefix(), "Rejected: destination server ", *dst_endpoint,
+                                    " is unavailable");
+                    // Closed explicitly: destructor of socket would clear the linger
+                    boost::system::error_code error;
+                    peer_sock.set_option(boost::asio::socket_base::linger(true, 0), error);
+                    peer_sock.close(error);
+                    co_return;
+                }
+                if (connect_attempt.is_probe())
+                    metrics::add(metrics::Counter::CircuitBreakerProbes);
+            }
+
+            // Connection is made from client's address, so families must match
+            if (m_config->transparent && dst_endpoint->address().is_v6() != is_ipv6)
+                throw std::runtime_error("Destination server " + dst_endpoint->address().to_string()
+                                         + " and client have different address families");
+            auto& ds_sock = session->ds_sock();
+            ds_sock.open(dst_endpoint->protocol());
+            auto set_ds_sock_opt_int = [&ds_sock](int level, int optname, int optvalue) {
+                set_socket_option(ds_sock, level, optname, optvalue);
             };
             // Make sure it will fail fast. There is no packet loss on loopback.
             set_ds_sock_opt_int(IPPROTO_TCP, TCP_SYNCNT, 2);
-            set_ds_sock_opt_int(IPPROTO_IP, IP_TRANSPARENT, 1);
-            // We can live without SO_REUSEADDR. But, since we are doing bind-before-connect, the 5-tuple will go into
-            set_ds_sock_opt_int(SOL_SOCKET, SO_REUSEADDR, 1);
-            set_ds_sock_opt_int(SOL_SOCKET, SO_MARK, m_config->mark);
+            if (m_config->transparent) {
+                if (is_ipv6)
+                    set_ds_sock_opt_int(IPPROTO_IPV6, IPV6_TRANSPARENT, 1);
+                else
+                    set_ds_sock_opt_int(IPPROTO_IP, IP_TRANSPARENT, 1);
+                // We can live without SO_REUSEADDR. But, since we are doing bind-before-connect, the 5-tuple will go into
+                set_ds_sock_opt_int(SOL_SOCKET, SO_REUSEADDR, 1);
+                set_ds_sock_opt_int(SOL_SOCKET, SO_MARK, m_config->mark);
+            }
+            set_keepalive(ds_sock);
+            // Connection is established by the first write, so it is used only when there is payload to write
+            // (otherwise destination server, which speaks first, would never be connected)
+            auto is_fast_open = m_config->tcp_fastopen_connect && !payload.empty();
+            if (is_fast_open)
+                set_ds_sock_opt_int(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+            // Port is not reserved by bind(), when it is selected by kernel (only client's port 0 lets it select).
+            // The option of level IP applies to IPv6 sockets too.
+            if (m_config->transparent && proxy_header->src_port == 0)
+                set_ds_sock_opt_int(IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, 1);
 
             // Bind-before-connect to select source IP.
-            auto client_ip = boost::asio::ip::address_v4(proxy_header->src_ip.host);
-            ds_sock.bind({client_ip, proxy_header->src_port});
+            if (m_config->transparent)
+                ds_sock.bind({proxy_header->src_ip, proxy_header->src_port});
+
+            auto connect_start_time = std::chrono::steady_clock::now();
+            boost::system::error_code connect_error;
+            co_await ds_sock.async_connect(*dst_endpoint, with_error(connect_error));
+            // With TCP Fast Open, connect() completes at once, and SYN is sent by the first write: with the payload,
+            // when the kernel has a cookie of destination server, or alone otherwise (the write fails with
+            // EINPROGRESS), then connecting is completed as usual and the payload is written after it
+            auto is_payload_written = false;
+            if (!connect_error && is_fast_open) {
+                co_await boost::asio::async_write(
+                    ds_sock, boost::asio::buffer(payload.data(), payload.size()), with_error(connect_error));
+                if (connect_error == boost::asio::error::in_progress) {
+                    co_await ds_sock.async_wait(boost::asio::socket_base::wait_write, with_error(connect_error));
+                    if (!connect_error) {
+                        int socket_error = 0;
+                        socklen_t size = sizeof(socket_error);
+                        if (::getsockopt(ds_sock.native_handle(), SOL_SOCKET, SO_ERROR, &socket_error, &size) != 0)
+                            socket_error = errno;
+                        connect_error.assign(socket_error, boost::system::system_category());
+                    }
+                } else {
+                    is_payload_written = !connect_error;
+                }
+            }
+            if (connect_error) {
+                metrics::add(metrics::Counter::ConnectErrors);
+                // Other failures (for example, 4-tuple of client is still in use) release the attempt without verdict
+                if (is_destination_failure(connect_error) && connect_attempt.fail()) {
+                    metrics::add(metrics::Counter::CircuitBreakerTrips);
+                    metrics::add(metrics::Gauge::UnavailableDestinations, 1);
+                    PROGDN_LOG_WARNING("Destination server ", *dst_endpoint, " is unavailable after ",
+                                       m_config->circuit_breaker_failures, " failures to connect");
+                }
+                throw boost::system::system_error(connect_error);
+            }
+            if (connect_attempt.succeed()) {
+                metrics::add(metrics::Gauge::UnavailableDestinations, -1);
+                PROGDN_LOG_INFO("Destination server ", *dst_endpoint, " is available again");
+            }
+            timeline.mark(SessionTimeline::Connected);
+            metrics::observe(metrics::Histogram::ConnectLatency, std::chrono::duration_cast<metrics::Duration>(
+                timeline.times[SessionTimeline::Connected] - connect_start_time));
+
+            if (!payload.empty()) {
+                // Payload arrived together with the header
+                timeline.times[SessionTimeline::FirstUpstreamByte] = timeline.times[SessionTimeline::HeaderReceived];
+                if (!is_payload_written)
+                    co_await boost::asio::async_write(
+                        ds_sock, boost::asio::buffer(payload.data(), payload.size()), boost::asio::use_awaitable);
+                metrics::add(metrics::Counter::BytesUpstream, payload.size());
+            }
+
+            session->start_timeouts();
+#ifdef PROGDN_RVI_SOCKMAP
+            if (m_sockmap) {
+                // The kernel program gets received data by whole skbs, so data after the header is relayed here,
+                // until no skb is left partially read. Then sockets are inserted at once (without suspension).
+                auto error = co_await relay_received(*session, peer_sock, ds_sock);
+                // Bytes written by user space are the base of bytes written by the kernel
+                uint64_t written_bytes[2];
+                if (!error)
+                    error = Sockmap::get_written_bytes(ds_sock.native_handle(), written_bytes[Session::Upstream]);
+                if (!error)
+                    error = Sockmap::get_written_bytes(peer_sock.native_handle(), written_bytes[Session::Downstream]);
+                if (!error)
+                    error = m_sockmap->insert(peer_sock.native_handle(), ds_sock.native_handle(), session->sockmap_pair());
+                if (!error) {
+                    boost::asio::co_spawn(
+                        io_context,
+                        offload_payload(shared_from_this(), session, Session::Upstream, peer_sock, ds_sock,
+                                        written_bytes[Session::Upstream]),
+                        boost::asio::detached);
+                    co_await offload_payload(shared_from_this(), session, Session::Downstream, ds_sock, peer_sock,
+                                             written_bytes[Session::Downstream]);
+                    co_return;
+                }
+                // Fallback to relay in user space (for example, when the maps are full or client has already
+                // sent all of its payload: only established sockets can be inserted)
+                if (error != ESHUTDOWN && error != EOPNOTSUPP)
+                    PROGDN_LOG_WARNING(session->log_prefix(), "Cannot insert sockets into sockmap: ", strerror(error));
+            }
+#endif
+            boost::asio::co_spawn(
+                io_context,
+                transmit_payload(shared_from_this(), session, Session::Upstream, peer_sock, ds_sock),
+                boost::asio::detached);
+            co_await transmit_payload(shared_from_this(), session, Session::Downstream, ds_sock, peer_sock);
+        }
 
-            auto dst_ip = boost::asio::ip::address_v4::loopback();
-            boost::asio::ip::tcp::endpoint dst_endpoint(dst_ip, proxy_header->dst_port);
-            ds_sock.async_connect(dst_endpoint, yield);
+        // Failures to connect, which show that destination server is down (others may be caused by client or by
+        // this host, so they do not make destination unavailable for everyone)
+        static bool is_destination_failure(const boost::system::error_code& error) noexcept {
+            return error == boost::asio::error::connection_refused
+                || error == boost::asio::error::timed_out
+                || error == boost::asio::error::host_unreachable
+                || error == boost::asio::error::network_unreachable;
+        }
 
-            if (!payload.empty())
-                boost::asio::async_write(ds_sock, boost::asio::buffer(payload.data(), payload.size()), yield);
+        // Enables TCP keepalive and TCP_USER_TIMEOUT according to configuration
+        void set_keepalive(boost::asio::ip::tcp::socket& sock) const {
+            using std::chrono::duration_cast;
+            using std::chrono::seconds;
+            if (m_config->tcp_keepalive_time.count() > 0) {
+                set_socket_option(sock, SOL_SOCKET, SO_KEEPALIVE, 1);
+                set_socket_option(sock, IPPROTO_TCP, TCP_KEEPIDLE,
+                                  std::max<int>(duration_cast<seconds>(m_config->tcp_keepalive_time).count(), 1));
+                if (m_config->tcp_keepalive_interval.count() > 0)
+                    set_socket_option(sock, IPPROTO_TCP, TCP_KEEPINTVL,
+                                      std::max<int>(duration_cast<seconds>(m_config->tcp_keepalive_interval).count(), 1));
+                if (m_config->tcp_keepalive_probes > 0)
+                    set_socket_option(sock, IPPROTO_TCP, TCP_KEEPCNT, m_config->tcp_keepalive_probes);
+            }
+            if (m_config->tcp_user_timeout.count() > 0)
+                set_socket_option(sock, IPPROTO_TCP, TCP_USER_TIMEOUT, m_config->tcp_user_timeout.count());
+        }
 
-            boost::asio::spawn(io_context, std::bind(
-                &Server::transmit_payload,
-                shared_from_this(),
-                session.id(),
-                std::ref(peer_sock),
-                std::ref(ds_sock),
-                std::placeholders::_1));
-            transmit_payload(session.id(), ds_sock, peer_sock, yield);
+        static void set_socket_option(boost::asio::ip::tcp::socket& sock, int level, int optname, int optvalue) {
+            if (::setsockopt(sock.native_handle(), level, optname, &optvalue, sizeof(optvalue)) < 0) {
+                auto error = errno;
+                throw std::runtime_error("Cannot set option " + std::to_string(optname)
+                                         + " to value " + std::to_string(optvalue)
+                                         + " for the socket: " + strerror(error)
+                                         + (error == EPERM ? " (need to be root)" : ""));
+            }
         }
 
-        static
-        std::pair<boost::optional<haproxy_protocol::Header>, boost::string_view>
+        // Parsed header and payload received after it (no header on error)
+        using ProxyHeader = std::pair<boost::optional<haproxy_protocol::Header>, boost::string_view>;
+
+        Awaitable<ProxyHeader>
         recv_proxy_header(
-            boost::asio::ip::tcp::socket& peer_sock,
-            boost::asio::yield_context& yield,
-            std::array<char, haproxy_protocol::tcp4::kMaximalHeaderSize>& buffer,
+            Session& session,
+            std::array<char, haproxy_protocol::kMaximalHeaderSize>& buffer,
             std::string* error_buffer = nullptr)
         {
-            static const boost::posix_time::minutes kTimeToReceiveProxyHeader(1);
-            auto& io_context = peer_sock.get_executor().context();
-            boost::asio::deadline_timer timer(io_context);
-            timer.expires_from_now(kTimeToReceiveProxyHeader);
-            timer.async_wait([&peer_sock](const boost::system::error_code& error) {
-                if (error != boost::asio::error::operation_aborted)
-                    peer_sock.cancel();
-            });
+            auto& peer_sock = session.peer_sock();
+            TimingWheel::Timer timer([&session]() { session.reap(Session::ReapReason::HeaderTimeout); });
+            if (m_config->header_timeout.count() > 0)
+                m_timing_wheel.arm(timer, m_config->header_timeout);
 
+            haproxy_protocol::Header parsed_header;
+            haproxy_protocol::ParseResult parse_result = {
+                haproxy_protocol::ParseStatus::Incomplete, 0, haproxy_protocol::Error::None
+            };
             size_t actual_buffer_size = 0;
-            size_t proxy_header_size = 0;
-            while (actual_buffer_size < buffer.size())
+            while (parse_result.status == haproxy_protocol::ParseStatus::Incomplete)
             {
+                if (actual_buffer_size == buffer.size()) {
+                    metrics::add(metrics::header_error(haproxy_protocol::Error::TooLongHeader));
+                    if (error_buffer)
+                        *error_buffer = "Too long header";
+                    co_return ProxyHeader();
+                }
                 boost::system::error_code error;
                 auto free_space = buffer.size() - actual_buffer_size;
-                auto bytes_received = peer_sock.async_read_some(
+                auto bytes_received = co_await peer_sock.async_read_some(
                     boost::asio::buffer(&buffer.at(actual_buffer_size), free_space),
-                    yield[error]);
+                    with_error(error));
                 if (error) {
+                    count_header_read_error(session);
                     if (error_buffer)
                         *error_buffer = error.message();
-                    return {};
+                    co_return ProxyHeader();
                 }
                 actual_buffer_size += bytes_received;
-                boost::string_view header(buffer.data(), actual_buffer_size);
-                auto end_marker_pos = header.find(haproxy_protocol::kEndMarker);
-                if (end_marker_pos != boost::string_view::npos) {
-                    proxy_header_size = end_marker_pos;
-                    // Replace end-marker with null, because futher processing will use string_view
-                    buffer.at(proxy_header_size) = 0;
-                    break;
+                parse_result = haproxy_protocol::parse(buffer.data(), actual_buffer_size, parsed_header);
+            }
+            if (parse_result.status == haproxy_protocol::ParseStatus::Invalid) {
+                metrics::add(metrics::header_error(parse_result.error));
+                if (error_buffer)
+                    *error_buffer = haproxy_protocol::to_string(parse_result.error);
+                co_return ProxyHeader();
+            }
+
+            // Skip rest of header (TLVs of version 2), which does not fit into the buffer
+            while (parse_result.header_size > actual_buffer_size) {
+                auto bytes_to_skip = std::min(parse_result.header_size - actual_buffer_size, buffer.size());
+                boost::system::error_code error;
+                co_await boost::asio::async_read(
+                    peer_sock, boost::asio::buffer(buffer.data(), bytes_to_skip), with_error(error));
+                if (error) {
+                    count_header_read_error(session);
+                    if (error_buffer)
+                        *error_buffer = error.message();
+                    co_return ProxyHeader();
                 }
+                actual_buffer_size += bytes_to_skip;
             }
             timer.cancel();
 
-            haproxy_protocol::Header parsed_header;
-            // Replace all space and end-marker with nulls, because further processing will use string_view
-            for (size_t i = 0; i < proxy_header_size; ++i) {
-                if (buffer[i] == ' ')
-                    buffer[i] = 0;
-            }
-            size_t parsed_data_size = 0;
-            for (size_t index = 1; index <= 6; ++index) {
-                boost::string_view value(&buffer.at(parsed_data_size));
-                switch (index)
+            // Payload is left in the buffer only after a header, which fits into it (skipped TLVs leave none, and
+            // then the header ends beyond the buffer)
+            boost::string_view payload;
+            if (actual_buffer_size > parse_result.header_size)
+                payload = boost::string_view(buffer.data() + parse_result.header_size,
+                                             actual_buffer_size - parse_result.header_size);
+            co_return std::make_pair(parsed_header, payload);
+        }
+
+        // Read of header fails either because of timeout (socket is closed by the timer) or because of client
+        static void count_header_read_error(const Session& session) noexcept {
+            metrics::add(session.reap_reason() == Session::ReapReason::HeaderTimeout
+                ? metrics::Counter::HeaderTimeouts
+                : metrics::Counter::HeaderReadErrors);
+        }
+
+#ifdef PROGDN_RVI_SOCKMAP
+        // Relays data, which is already received, until the socket has no more. Returns errno on failure.
+        static Awaitable<int> relay_received(
+            Session& session,
+            boost::asio::ip::tcp::socket& src_sock,
+            boost::asio::ip::tcp::socket& dst_sock)
+        {
+            src_sock.non_blocking(true);
+            while (true)
+            {
+                boost::system::error_code error;
+                auto buffer = BufferPool::borrow(BufferPool::Large);
+                auto bytes_received = src_sock.read_some(boost::asio::buffer(buffer.data(), buffer.size()), error);
+                if (error == boost::asio::error::would_block)
+                    co_return 0;
+                if (error == boost::asio::error::interrupted)
+                    continue;
+                if (error)
+                    co_return (error == boost::asio::error::eof) ? ESHUTDOWN : error.value();
+                session.on_activity(Session::Upstream);
+                metrics::add(metrics::Counter::BytesUpstream, bytes_received);
+                co_await boost::asio::async_write(
+                    dst_sock, boost::asio::buffer(buffer.data(), bytes_received), with_error(error));
+                if (error)
+                    co_return error.value();
+            }
+        }
+
+        // Payload is relayed by the kernel, so it only waits for end of payload from the source and for the
+        // destination to write all of it (then it is shut down, as in other engines)
+        static Awaitable<> offload_payload(
+            std::shared_ptr<Server> self,
+            std::shared_ptr<Session> session,
+            Session::Direction direction,
+            boost::asio::ip::tcp::socket& src_sock,
+            boost::asio::ip::tcp::socket& dst_sock,
+            uint64_t written_base)
+        {
+            // Interval of checks of data, which is not passed to the kernel program yet, and of written bytes
+            static const std::chrono::milliseconds kMinimalInterval(1);
+            static const std::chrono::milliseconds kMaximalInterval(100);
+
+            try {
+                boost::asio::steady_timer timer(*self->m_io_context);
+                boost::system::error_code error;
+                // Event loop is single-threaded, so readiness cannot be missed between poll() and async_wait()
+                while (true)
                 {
-                case 1:
-                    if (value != "PROXY") {
-                        if (error_buffer)
-                            *error_buffer = "Not a PROXY protocol header";
-                        return {};
+                    pollfd poll_fd = { src_sock.native_handle(), POLLIN | POLLRDHUP, 0 };
+                    if (::poll(&poll_fd, 1, 0) < 0)
+                        poll_fd.revents = 0;
+                    if (poll_fd.revents & POLLERR) {
+                        int socket_error = 0;
+                        socklen_t size = sizeof(socket_error);
+                        ::getsockopt(src_sock.native_handle(), SOL_SOCKET, SO_ERROR, &socket_error, &size);
+                        // EPIPE is set by the kernel relay of the other direction, when end of its payload is
+                        // redirected to the socket after it was shut down for sending; receiving is not affected
+                        // (and the error is cleared by reading it)
+                        if (socket_error != EPIPE) {
+                            if (socket_error == ETIMEDOUT)
+                                session->reap(Session::ReapReason::DeadPeer);
+                            else
+                                dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
+                            co_return;
+                        }
+                        poll_fd.revents &= ~POLLERR;
+                    }
+                    if (poll_fd.revents & (POLLRDHUP | POLLHUP))
+                        break;
+                    if (poll_fd.revents & POLLIN) {
+                        // Received before the socket was inserted: the program gets it, when socket is woken up
+                        int low_watermark = 1;
+                        ::setsockopt(src_sock.native_handle(), SOL_SOCKET, SO_RCVLOWAT,
+                                     &low_watermark, sizeof(low_watermark));
+                        timer.expires_after(kMinimalInterval);
+                        co_await timer.async_wait(with_error(error));
+                    } else {
+                        co_await src_sock.async_wait(boost::asio::socket_base::wait_read, with_error(error));
+                    }
+                    if (error) {
+                        if (error != boost::asio::error::operation_aborted)
+                            dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
+                        co_return;
                     }
+                }
+
+                // Redirected data may still be queued to the destination by the kernel
+                auto redirected_bytes = session->sockmap_pair().redirected_bytes(direction);
+                auto interval = kMinimalInterval;
+                uint64_t written_bytes = 0;
+                while (Sockmap::get_written_bytes(dst_sock.native_handle(), written_bytes) == 0
+                       && written_bytes < written_base + redirected_bytes)
+                {
+                    timer.expires_after(interval);
+                    co_await timer.async_wait(with_error(error));
+                    if (error)
+                        co_return;
+                    interval = std::min(interval * 2, kMaximalInterval);
+                }
+                dst_sock.shutdown(boost::asio::socket_base::shutdown_send, error);
+                session->on_end_of_payload(direction);
+            } catch (const std::exception& e) {
+                PROGDN_LOG_ERROR(session->log_prefix(), "Cannot transmit payload: ", e.what());
+            } catch (...) {
+            }
+        }
+#endif
+
+        static metrics::Counter bytes_counter(Session::Direction direction) noexcept {
+            return (direction == Session::Upstream) ? metrics::Counter::BytesUpstream : metrics::Counter::BytesDownstream;
+        }
+
+        // Server and session are kept alive by the coroutine (sockets belong to the session)
+        static Awaitable<> transmit_payload(
+            std::shared_ptr<Server> self,
+            std::shared_ptr<Session> session,
+            Session::Direction direction,
+            boost::asio::ip::tcp::socket& src_sock,
+            boost::asio::ip::tcp::socket& dst_sock)
+        {
+            try {
+#ifdef PROGDN_RVI_IO_URING
+                if (self->m_io_uring) {
+                    co_await uring_payload(
+                        *session, direction, src_sock, dst_sock, *self->m_io_uring, *self->m_io_uring_buffers);
+                    co_return;
+                }
+#endif
+                if (self->m_config->relay == Config::Relay::Splice) {
+                    Pipe pipe;
+                    auto error = pipe.open();
+                    if (!error) {
+                        co_await splice_payload(*session, direction, src_sock, dst_sock, pipe);
+                        co_return;
+                    }
+                    // Fallback to copying (for example, on lack of file descriptors)
+                    PROGDN_LOG_WARNING(session->log_prefix(), "Cannot create pipe for splice: ", strerror(error));
+                }
+                co_await copy_payload(*session, direction, src_sock, dst_sock, self->m_memory_budget.get());
+            } catch (const std::exception& e) {
+                PROGDN_LOG_ERROR(session->log_prefix(), "Cannot transmit payload: ", e.what());
+            } catch (...) {
+            }
+        }
+
+        // Copies payload through a buffer borrowed from the pool only when source socket has data to read,
+        // so idle connections do not hold buffers. Flows, which keep filling the buffer, switch to larger ones
+        // (unless memory budget is constrained, then they switch back to small ones).
+        static Awaitable<> copy_payload(
+            Session& session,
+            Session::Direction direction,
+            boost::asio::ip::tcp::socket& src_sock,
+            boost::asio::ip::tcp::socket& dst_sock,
+            const MemoryBudget* memory_budget)
+        {
+            // Number of consecutive reads, which fill the whole buffer, to switch to larger buffer (and vice versa)
+            static const unsigned kReadsToResize = 4;
+
+            auto size_class = BufferPool::Small;
+            unsigned reads_to_resize = kReadsToResize;
+            src_sock.non_blocking(true);
+            while (true)
+            {
+                boost::system::error_code error;
+                co_await src_sock.async_wait(boost::asio::socket_base::wait_read, with_error(error));
+                if (error) {
+                    if (error != boost::asio::error::operation_aborted)
+                        dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
                     break;
-                case 2:
-                    if (value != "TCP4") {
-                        if (error_buffer)
-                            *error_buffer = "Only TCP4 is supported";
-                        return {};
+                }
+
+                auto buffer = BufferPool::borrow(size_class);
+                auto bytes_received = src_sock.read_some(boost::asio::buffer(buffer.data(), buffer.size()), error);
+                if (error) {
+                    if (error == boost::asio::error::would_block || error == boost::asio::error::interrupted)
+                        continue;
+                    if (error == boost::asio::error::eof) {
+                        dst_sock.shutdown(boost::asio::socket_base::shutdown_send, error);
+                        session.on_end_of_payload(direction);
+                    } else if (error == boost::asio::error::timed_out) {
+                        session.reap(Session::ReapReason::DeadPeer);
+                    } else {
+                        dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
                     }
                     break;
-                case 3:
-                    parsed_header.src_ip = IP_Host(value.data());
+                }
+
+                session.on_activity(direction);
+                metrics::add(bytes_counter(direction), bytes_received);
+                co_await boost::asio::async_write(
+                    dst_sock, boost::asio::buffer(buffer.data(), bytes_received), with_error(error));
+                if (error) {
+                    if (error == boost::asio::error::timed_out)
+                        session.reap(Session::ReapReason::DeadPeer);
+                    else
+                        src_sock.shutdown(boost::asio::socket_base::shutdown_receive, error);
                     break;
-                case 4:
-                    parsed_header.dst_ip = IP_Host(value.data());
+                }
+
+                auto is_constrained = memory_budget && memory_budget->level() >= MemoryBudget::Level::Constrained;
+                if (is_constrained && size_class == BufferPool::Large) {
+                    size_class = BufferPool::Small;
+                    reads_to_resize = kReadsToResize;
+                    continue;
+                }
+                auto is_resize_needed = (size_class == BufferPool::Small)
+                    ? (bytes_received == buffer.size() && !is_constrained)
+                    : (bytes_received <= BufferPool::kSmallBufferSize);
+                reads_to_resize = is_resize_needed ? reads_to_resize - 1 : kReadsToResize;
+                if (reads_to_resize == 0) {
+                    size_class = (size_class == BufferPool::Small) ? BufferPool::Large : BufferPool::Small;
+                    reads_to_resize = kReadsToResize;
+                }
+            }
+        }
+
+        // Moves payload with splice(2): source socket -> pipe -> destination socket.
+        // Coroutine waits for readiness of sockets, so payload is never copied to user space.
+        static Awaitable<> splice_payload(
+            Session& session,
+            Session::Direction direction,
+            boost::asio::ip::tcp::socket& src_sock,
+            boost::asio::ip::tcp::socket& dst_sock,
+            const Pipe& pipe)
+        {
+            // Maximal amount of data moved to the pipe at once (default capacity of a pipe)
+            static const size_t kMaximalChunkSize = 65536;
+            static const unsigned kSpliceFlags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+            src_sock.native_non_blocking(true);
+            dst_sock.native_non_blocking(true);
+            while (true)
+            {
+                boost::system::error_code error;
+                co_await src_sock.async_wait(boost::asio::socket_base::wait_read, with_error(error));
+                if (error) {
+                    if (error != boost::asio::error::operation_aborted)
+                        dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
                     break;
-                case 5:
-                    parsed_header.src_port = boost::lexical_cast<uint16_t>(value.data(), value.size());
+                }
+
+                auto bytes_received = ::splice(src_sock.native_handle(), nullptr, pipe.write_end(), nullptr,
+                                               kMaximalChunkSize, kSpliceFlags);
+                if (bytes_received == 0) {
+                    dst_sock.shutdown(boost::asio::socket_base::shutdown_send, error);
+                    session.on_end_of_payload(direction);
                     break;
-                case 6:
-                    parsed_header.dst_port = boost::lexical_cast<uint16_t>(value.data(), value.size());
+                }
+                if (bytes_received < 0) {
+                    if (errno == EAGAIN || errno == EINTR)
+                        continue;
+                    if (errno == ETIMEDOUT)
+                        session.reap(Session::ReapReason::DeadPeer);
+                    else
+                        dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
                     break;
                 }
-                parsed_data_size += value.size() + 1;
-            }
-            auto payload_begin = parsed_data_size + 1;
-            auto payload_size = actual_buffer_size - payload_begin;
-            if (payload_begin + payload_size != actual_buffer_size)
-                throw std::logic_error("Buffer overflow on access to payload after Proxy Header");
-            boost::string_view payload(&buffer.at(payload_begin), payload_size);
-            return std::make_pair(parsed_header, payload);
-        }
 
-        static std::string get_string_remote_endpoint(const boost::asio::ip::tcp::socket& sock) {
-            auto remote_endpoint = sock.remote_endpoint();
-            return (remote_endpoint.address().to_string() + ':' + std::to_string(remote_endpoint.port()));
+                session.on_activity(direction);
+                metrics::add(bytes_counter(direction), static_cast<uint64_t>(bytes_received));
+                auto bytes_in_pipe = static_cast<size_t>(bytes_received);
+                while (bytes_in_pipe > 0)
+                {
+                    auto bytes_sent = ::splice(pipe.read_end(), nullptr, dst_sock.native_handle(), nullptr,
+                                               bytes_in_pipe, kSpliceFlags);
+                    if (bytes_sent > 0) {
+                        bytes_in_pipe -= static_cast<size_t>(bytes_sent);
+                        continue;
+                    }
+                    if (bytes_sent < 0 && (errno == EAGAIN || errno == EINTR)) {
+                        co_await dst_sock.async_wait(boost::asio::socket_base::wait_write, with_error(error));
+                        if (!error)
+                            continue;
+                    } else if (bytes_sent < 0 && errno == ETIMEDOUT) {
+                        session.reap(Session::ReapReason::DeadPeer);
+                        co_return;
+                    }
+                    src_sock.shutdown(boost::asio::socket_base::shutdown_receive, error);
+                    co_return;
+                }
+            }
         }
 
-        void transmit_payload(
-            size_t session_id,
+#ifdef PROGDN_RVI_IO_URING
+        // Receives payload into a buffer, which is selected by the kernel from the group provided to the ring only
+        // when data arrives (own buffer is borrowed from the pool, when the group is exhausted), then sends it.
+        static Awaitable<> uring_payload(
+            Session& session,
+            Session::Direction direction,
             boost::asio::ip::tcp::socket& src_sock,
             boost::asio::ip::tcp::socket& dst_sock,
-            boost::asio::yield_context yield)
+            IoUring& ring,
+            IoUring::BufferGroup& buffers)
         {
-            try {
-                std::vector<char> buffer(8192);
-                while (true)
-                {
-                    boost::system::error_code error;
-                    auto bytes_received = src_sock.async_read_some(boost::asio::buffer(buffer.data(), buffer.size()), yield[error]);
-                    if (error) {
-                        if (error == boost::asio::error::eof)
-                            dst_sock.shutdown(boost::asio::socket_base::shutdown_send, error);
-                        else if (error != boost::asio::error::operation_aborted)
-                            dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
-                        break;
+            // Operations of io_uring on a non-blocking socket fail with EAGAIN instead of waiting
+            auto src_fd = src_sock.native_handle();
+            auto dst_fd = dst_sock.native_handle();
+            for (auto fd : { src_fd, dst_fd })
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+            while (true)
+            {
+                boost::system::error_code error;
+                BufferPool::Buffer own_buffer;
+                auto completion = co_await ring.async_submit([&](io_uring_sqe& entry) {
+                    entry.opcode = IORING_OP_RECV;
+                    entry.fd = src_fd;
+                    entry.len = static_cast<uint32_t>(buffers.buffer_size());
+                    entry.flags = IOSQE_BUFFER_SELECT;
+                    entry.buf_group = buffers.id();
+                }, with_error(error));
+                if (error == boost::asio::error::no_buffer_space) {
+                    // Buffer is borrowed, when data arrives, so idle sessions do not hold buffers of the pool
+                    co_await src_sock.async_wait(boost::asio::socket_base::wait_read, with_error(error));
+                    if (!error) {
+                        own_buffer = BufferPool::borrow(BufferPool::Large);
+                        completion = co_await ring.async_submit([&](io_uring_sqe& entry) {
+                            entry.opcode = IORING_OP_RECV;
+                            entry.fd = src_fd;
+                            entry.addr = reinterpret_cast<uintptr_t>(own_buffer.data());
+                            entry.len = static_cast<uint32_t>(own_buffer.size());
+                        }, with_error(error));
                     }
+                }
 
-                    boost::asio::async_write(dst_sock, boost::asio::buffer(buffer.data(), bytes_received), yield[error]);
-                    if (error) {
+                auto is_provided = !error && (completion.flags & IORING_CQE_F_BUFFER);
+                auto buffer_id = static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+                auto data = is_provided ? buffers.data(buffer_id) : own_buffer.data();
+                auto bytes_received = error ? 0 : static_cast<size_t>(completion.result);
+                // Session is reaped (sockets are closed)
+                if (!src_sock.is_open() || !dst_sock.is_open()) {
+                    if (is_provided)
+                        buffers.give_back(buffer_id);
+                    break;
+                }
+                if (error) {
+                    if (error == boost::asio::error::interrupted)
+                        continue;
+                    if (error == boost::asio::error::timed_out)
+                        session.reap(Session::ReapReason::DeadPeer);
+                    else
+                        dst_sock.shutdown(boost::asio::socket_base::shutdown_both, error);
+                    break;
+                }
+                if (bytes_received == 0) {
+                    if (is_provided)
+                        buffers.give_back(buffer_id);
+                    dst_sock.shutdown(boost::asio::socket_base::shutdown_send, error);
+                    session.on_end_of_payload(direction);
+                    break;
+                }
+
+                session.on_activity(direction);
+                metrics::add(bytes_counter(direction), bytes_received);
+                size_t bytes_sent = 0;
+                while (!error && bytes_sent < bytes_received) {
+                    completion = co_await ring.async_submit([&](io_uring_sqe& entry) {
+                        entry.opcode = IORING_OP_SEND;
+                        entry.fd = dst_fd;
+                        entry.addr = reinterpret_cast<uintptr_t>(data + bytes_sent);
+                        entry.len = static_cast<uint32_t>(bytes_received - bytes_sent);
+                        entry.msg_flags = MSG_NOSIGNAL;
+                    }, with_error(error));
+                    if (!error)
+                        bytes_sent += static_cast<size_t>(completion.result);
+                    else if (error == boost::asio::error::interrupted)
+                        error.clear();
+                }
+                if (is_provided)
+                    buffers.give_back(buffer_id);
+                if (error) {
+                    if (error == boost::asio::error::timed_out)
+                        session.reap(Session::ReapReason::DeadPeer);
+                    else if (src_sock.is_open())
                         src_sock.shutdown(boost::asio::socket_base::shutdown_receive, error);
-                        break;
-                    }
+                    break;
                 }
+            }
+        }
+#endif
+
+        void init_sockmap() {
+#ifdef PROGDN_RVI_SOCKMAP
+            // Capacity of maps of a thread, when the number of sessions is not limited
+            static const size_t kDefaultCapacity = 65536;
+            try {
+                m_sockmap = std::make_shared<Sockmap>(m_max_sessions > 0 ? m_max_sessions : kDefaultCapacity);
             } catch (const std::exception& e) {
-                if (Log::is_enabled())
-                    Log::error("[Session #%" + std::to_string(session_id) + "] Cannot transmit payload: " + e.what());
-            } catch (...) {
+                PROGDN_LOG_WARNING("Relay engine 'sockmap' is not supported, 'copy' is used: ", e.what());
+            }
+#else
+            PROGDN_LOG_WARNING("Relay engine 'sockmap' is not built, 'copy' is used");
+#endif
+        }
+
+        void init_io_uring() {
+#ifdef PROGDN_RVI_IO_URING
+            static const unsigned kRingEntries = 1024;
+            // Sessions of a thread, when their number is not limited
+            static const size_t kDefaultSessions = 65536;
+            // IORING_MAX_CQ_ENTRIES of the kernel (larger queue is clamped anyway)
+            static const size_t kMaximalCompletions = 65536;
+            try {
+                // Each session has a receive or send operation per direction, and buffers are given back by
+                // operations too
+                auto sessions = (m_max_sessions > 0) ? m_max_sessions : kDefaultSessions;
+                auto completions = std::min<size_t>(sessions * 2 + m_config->io_uring_buffers, kMaximalCompletions);
+                m_io_uring.reset(new IoUring(*m_io_context, kRingEntries, static_cast<unsigned>(completions)));
+                m_io_uring_buffers.reset(
+                    new IoUring::BufferGroup(*m_io_uring, 0, kIoUringBufferSize, m_config->io_uring_buffers));
+                return;
+            } catch (const std::exception& e) {
+                m_io_uring_buffers.reset();
+                m_io_uring.reset();
+                PROGDN_LOG_WARNING("Relay engine 'io_uring' is not supported, 'copy' is used: ", e.what());
             }
+#else
+            PROGDN_LOG_WARNING("Relay engine 'io_uring' is not built, 'copy' is used");
+#endif
         }
 
     public:
-        void shutdown() noexcept
+        // Memory reserved by all servers regardless of sessions (buffers of io_uring)
+        static size_t reserved_size(const Config& config) noexcept {
+            if (config.relay != Config::Relay::IoUring)
+                return 0;
+            return config.threads * config.io_uring_buffers * kIoUringBufferSize;
+        }
+
+        const std::shared_ptr<boost::asio::io_context>& io_context() const noexcept {
+            return m_io_context;
+        }
+
+        // CPU, to which the thread of the event loop must be pinned (-1 - not pinned)
+        int cpu() const noexcept {
+            return m_cpu;
+        }
+
+        // Thread-safe: new sessions are routed by the table since it is replaced within the thread of own io_context
+        void set_routing_table(const std::shared_ptr<const RoutingTable>& routing_table) noexcept
         {
-            try
-            {
-                if (!m_is_shutdown_requested)
-                {
-                    m_is_shutdown_requested = true;
-                    try { m_acceptor.close(); } catch (...) {}
+            try {
+                auto self = shared_from_this();
+                boost::asio::post(*m_io_context, [self, routing_table]() {
+                    self->m_routing_table = routing_table;
+                });
+            } catch (...) {}
+        }
 
-                    auto total_sessions = Session::total_objects();
-                    if (total_sessions > 0)
-                        Log::info("There are " + std::to_string(total_sessions) + " proxified connections. Waiting for finish...");
-                }
+        // Thread-safe: stops accepting within the thread of own io_context.
+        // Event loop finishes, when its last session is closed.
+        void shutdown() noexcept
+        {
+            try {
+                auto self = shared_from_this();
+                boost::asio::post(*m_io_context, [self]() {
+                    if (!self->m_is_shutdown_requested) {
+                        self->m_is_shutdown_requested = true;
+                        // Listening sockets handed over to a new instance stay open there
+                        for (auto& acceptor : self->m_acceptors)
+                            try { acceptor.close(); } catch (...) {}
+                    }
+                });
             } catch (...) {}
         }
     };
@@ -367,33 +1621,207 @@ int main(int argc, char** argv)
 {
     using namespace progdn;
     Log::Deleter log_deleter;
+    // Writer of trace reports failures to the log, so it is stopped and joined before the log is deleted
+    SessionTrace::Deleter trace_deleter;
     try {
         auto& log = Log::create_instance();
-        log->emplace_writer<SystemLog>("progdn-rvi");
+        // Event loops must not be blocked by syslog, so records are written by a separate thread
+        auto& log_writer = log->emplace_writer<AsyncLogWriter>(
+            std::unique_ptr<Log::Writer>(new SystemLog("progdn-rvi")));
 
         CommandLineInterface cli(argc, argv);
-        auto config = std::make_shared<progdn::Config>(cli.conf);
+        Log::set_level(Log::parse_level(cli.log_level));
+        // Configuration is reloaded after daemon(), which changes working directory
+        auto conf_path = boost::filesystem::absolute(cli.conf);
+        auto config = std::make_shared<progdn::Config>(conf_path);
+        // File is opened before daemon(), which changes working directory
+        if (!config->trace_file.empty())
+            SessionTrace::create_instance(config->trace_file, config->trace_sample_rate);
         if (cli.is_option_specified(cli.kOption_Background))
             if (::daemon(0, 0) != 0)
                 throw std::runtime_error(std::string("Cannot run process in background: ") + ::strerror(errno));
+        log_writer.start();
+        if (SessionTrace::is_instance_created())
+            Log::info("Trace file: " + config->trace_file + ", sample rate: 1/" + std::to_string(config->trace_sample_rate));
 
         SystemLimits::unlimit_open_files_number();
+        BufferPool::set_free_list_capacity(config->buffer_pool_capacity);
+
+        Log::info("Threads: " + std::to_string(config->threads));
+        if (!config->cpu_affinity.empty()) {
+            std::string cpus;
+            for (unsigned i = 0; i < config->threads; ++i)
+                cpus += (i > 0 ? ", " : "") + std::to_string(config->cpu_affinity[i % config->cpu_affinity.size()]);
+            Log::info("CPUs of threads: " + cpus);
+        }
+        std::shared_ptr<AdmissionControl> admission_control;
+        if (config->max_connections_per_ip > 0 || config->connect_rate_per_ip > 0) {
+            AdmissionControl::Limits limits = {
+                config->max_connections_per_ip, config->connect_rate_per_ip, config->connect_burst_per_ip
+            };
+            admission_control = std::make_shared<AdmissionControl>(limits, config->admission_table_size);
+        }
+
+        std::shared_ptr<CircuitBreaker> circuit_breaker;
+        if (config->circuit_breaker_failures > 0) {
+            CircuitBreaker::Settings settings = { config->circuit_breaker_failures, config->circuit_breaker_cooldown };
+            circuit_breaker = std::make_shared<CircuitBreaker>(settings);
+        }
+
+        std::shared_ptr<MemoryBudget> memory_budget;
+        if (config->memory_budget > 0) {
+            MemoryBudget::Settings settings = {
+                config->memory_budget, Session::estimated_size(*config), Server::reserved_size(*config)
+            };
+            memory_budget = std::make_shared<MemoryBudget>(settings);
+            Log::info("Memory budget: " + std::to_string(settings.budget / 1024) + " KB (session: "
+                      + std::to_string(settings.session_size) + " bytes, reserved: "
+                      + std::to_string(settings.fixed_size / 1024) + " KB)");
+        }
+
+        std::vector<std::shared_ptr<progdn::Server>> servers;
+        for (unsigned i = 0; i < config->threads; ++i) {
+            auto io_context = std::make_shared<boost::asio::io_context>(1);
+            servers.push_back(std::make_shared<progdn::Server>(
+                config, io_context, admission_control, circuit_breaker, memory_budget, i));
+        }
+
+        // Signals are handled by the event loop of the main thread
+        auto& main_io_context = *servers.front()->io_context();
+
+        // Listening sockets of running instance are distributed between servers. Servers without them
+        // join the group of SO_REUSEPORT with new sockets.
+        std::shared_ptr<ListenerHandoff> handoff;
+        std::vector<int> inherited_fds;
+        if (!config->handoff_path.empty()) {
+            handoff = std::make_shared<ListenerHandoff>(servers.front()->io_context(), config->handoff_path);
+            inherited_fds = handoff->take(config->listen);
+        }
+        std::vector<int> listening_fds;
+        for (size_t i = 0; i < servers.size(); ++i) {
+            std::vector<int> server_fds;
+            for (size_t j = i; j < inherited_fds.size(); j += servers.size())
+                server_fds.push_back(inherited_fds[j]);
+            servers[i]->start(config->listen, server_fds);
+            auto fds = servers[i]->listening_fds();
+            listening_fds.insert(listening_fds.end(), fds.begin(), fds.end());
+        }
 
-        auto io_context = std::make_shared<boost::asio::io_context>();
-        auto server = std::make_shared<progdn::Server>(config, io_context);
-        server->start(config->listen);
+        // SIGUSR1 prints statistics
+        boost::asio::signal_set stats_signals(main_io_context, SIGUSR1);
+        std::function<void(const boost::system::error_code&, int)> on_stats_signal;
+        on_stats_signal = [&stats_signals, &on_stats_signal](const boost::system::error_code& error, int) {
+            if (error == boost::asio::error::operation_aborted)
+                return;
+            auto occupancy = BufferPool::occupancy();
+            Log::info(boost::format("Sessions: %1%. Relay buffers (8K/64K) in use: %2%/%3%, free: %4%/%5%")
+                      % Session::total_objects()
+                      % occupancy.borrowed[BufferPool::Small] % occupancy.borrowed[BufferPool::Large]
+                      % occupancy.free[BufferPool::Small] % occupancy.free[BufferPool::Large]);
+            std::string reaped;
+            for (size_t i = 0; i < static_cast<size_t>(Session::ReapReason::kReasonsNumber); ++i) {
+                auto reason = static_cast<Session::ReapReason>(i);
+                reaped += std::string(reaped.empty() ? "" : ", ") + Session::to_string(reason) + ": "
+                    + std::to_string(Session::total_reaped(reason));
+            }
+            Log::info("Reaped sessions. " + reaped);
+            stats_signals.async_wait(on_stats_signal);
+        };
+        stats_signals.async_wait(on_stats_signal);
 
-        boost::asio::signal_set unix_signals(*io_context, SIGTERM);
-        unix_signals.async_wait([server](const boost::system::error_code& error, int) {
+        // SIGHUP reloads routes (other options are applied by restart). Live sessions keep their destinations.
+        Log::info("Routes: " + std::to_string(config->routing_table->routes().size()));
+        boost::asio::signal_set reload_signals(main_io_context, SIGHUP);
+        std::function<void(const boost::system::error_code&, int)> on_reload_signal;
+        on_reload_signal = [&reload_signals, &on_reload_signal, &servers, &conf_path](
+            const boost::system::error_code& error, int) {
+            if (error == boost::asio::error::operation_aborted)
+                return;
+            try {
+                auto routing_table = Config::parse_routing_table(IniFile::parse(conf_path));
+                for (auto& server : servers)
+                    server->set_routing_table(routing_table);
+                Log::info("Routes are reloaded: " + std::to_string(routing_table->routes().size()));
+            } catch (const std::exception& e) {
+                Log::error(std::string("Cannot reload routes, previous ones are kept: ") + e.what());
+            }
+            reload_signals.async_wait(on_reload_signal);
+        };
+        reload_signals.async_wait(on_reload_signal);
+
+        // Metrics endpoint is served by the event loop of the main thread
+        std::shared_ptr<StatsServer> stats_server;
+        if (config->stats_listen) {
+            stats_server = std::make_shared<StatsServer>(servers.front()->io_context());
+            stats_server->start(*config->stats_listen);
+        }
+
+        // Stops accepting, existing sessions are served until they are closed
+        boost::asio::signal_set unix_signals(main_io_context, SIGTERM);
+        auto stop_accepting = [&servers, &stats_signals, &reload_signals, &stats_server, &handoff, &unix_signals]() {
+            stats_signals.cancel();
+            reload_signals.cancel();
+            unix_signals.cancel();
+            if (stats_server)
+                stats_server->shutdown();
+            if (handoff)
+                handoff->shutdown();
+            for (auto& server : servers)
+                server->shutdown();
+            auto total_sessions = Session::total_objects();
+            if (total_sessions > 0)
+                Log::info("There are " + std::to_string(total_sessions) + " proxified connections. Waiting for finish...");
+        };
+        unix_signals.async_wait([&stop_accepting](const boost::system::error_code& error, int) {
             if (error != boost::asio::error::operation_aborted) {
                 Log::info("Received SIGTERM");
-                server->shutdown();
+                stop_accepting();
             }
         });
 
+        // Previous instance stops accepting only now, when all its sockets are served by this one
+        if (handoff) {
+            handoff->confirm();
+            handoff->start(listening_fds, stop_accepting);
+        }
+
+        // Threads pin themselves before they run event loops, so their thread-local buffer pools and metrics shards
+        // are first touched on the NUMA node of their CPU. Failures are reported before the log may be deleted.
+        auto pin_thread = [](int cpu) noexcept {
+            return cpu < 0 ? 0 : CpuAffinity::pin_thread(::pthread_self(), static_cast<unsigned>(cpu));
+        };
+        std::promise<void> start_promise;
+        std::shared_future<void> start_future = start_promise.get_future().share();
+        std::vector<std::future<int>> pin_results;
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < servers.size(); ++i) {
+            std::promise<int> pin_promise;
+            pin_results.push_back(pin_promise.get_future());
+            auto io_context = servers[i]->io_context();
+            threads.emplace_back(
+                [io_context, cpu = servers[i]->cpu(), pin_thread, start_future,
+                 pin_promise = std::move(pin_promise)]() mutable {
+                    pin_promise.set_value(pin_thread(cpu));
+                    start_future.wait();
+                    io_context->run();
+                });
+        }
+        for (size_t i = 0; i < servers.size(); ++i) {
+            auto error = i == 0 ? pin_thread(servers.front()->cpu()) : pin_results[i - 1].get();
+            if (error)
+                Log::warning("Cannot pin thread to CPU " + std::to_string(servers[i]->cpu()) + ": " + strerror(error));
+        }
+
         if (!cli.is_option_specified(cli.kOption_Verbose))
             Log::delete_instance();
-        io_context->run();
+        // Writer of trace is started, when the log is not deleted anymore
+        if (const auto& trace = SessionTrace::get_instance_or_null())
+            trace->start();
+        start_promise.set_value();
+        main_io_context.run();
+        for (auto& thread : threads)
+            thread.join();
+        SessionTrace::delete_instance();
 
         return 0;
     } catch (const std::exception& e) {
@@ -0,0 +1,68 @@
+#include "memory_budget.h"
+#include "metrics.h"
+
+#include <progdn_core/buffer_pool.h>
+
+#include <algorithm>
+
+namespace progdn
+{
+    MemoryBudget::MemoryBudget(const Settings& settings) :
+        m_settings(settings),
+        m_usage(0),
+        m_level(Level::Normal)
+    {
+        metrics::add(metrics::Gauge::MemoryBudget, static_cast<int64_t>(m_settings.budget));
+    }
+
+    bool MemoryBudget::update(size_t sessions_number) noexcept
+    {
+        size_t usage = m_settings.fixed_size + sessions_number * m_settings.session_size;
+        try {
+            auto occupancy = BufferPool::occupancy();
+            for (size_t i = 0; i < BufferPool::kSizeClassesNumber; ++i) {
+                auto size_class = static_cast<BufferPool::SizeClass>(i);
+                usage += (occupancy.borrowed[i] + occupancy.free[i]) * BufferPool::size_of(size_class);
+            }
+        } catch (...) {}
+
+        // Deltas of all threads sum up to the latest usage
+        auto previous_usage = m_usage.exchange(usage, std::memory_order_relaxed);
+        metrics::add(metrics::Gauge::MemoryUsage, static_cast<int64_t>(usage) - static_cast<int64_t>(previous_usage));
+
+        auto level = Level::Normal;
+        if (usage > m_settings.budget)
+            level = Level::Exceeded;
+        else if (usage >= m_settings.budget / 10 * 9)
+            level = Level::Saturated;
+        else if (usage >= m_settings.budget / 4 * 3)
+            level = Level::Constrained;
+        return m_level.exchange(level, std::memory_order_relaxed) != level;
+    }
+
+    size_t MemoryBudget::excess_sessions() const noexcept
+    {
+        auto usage = m_usage.load(std::memory_order_relaxed);
+        if (usage <= m_settings.budget)
+            return 0;
+        auto session_size = std::max<size_t>(m_settings.session_size, 1);
+        return (usage - m_settings.budget + session_size - 1) / session_size;
+    }
+
+    const char* MemoryBudget::to_string(Level level) noexcept
+    {
+        switch (level)
+        {
+        case Level::Normal:
+            return "normal";
+        case Level::Constrained:
+            return "constrained (relay buffers are not enlarged)";
+        case Level::Saturated:
+            return "saturated (accepting is paused)";
+        case Level::Exceeded:
+            return "exceeded (the newest sessions are closed)";
+        default:
+            return "???";
+        }
+    }
+}
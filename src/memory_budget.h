@@ -0,0 +1,68 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <cstddef>
+
+namespace progdn
+{
+    // Global budget of memory reserved by sessions: their objects, frames of coroutines and kernel state of sockets
+    // (estimated per session), relay buffers of the pool (in use and free) and fixed reservations (buffers of
+    // io_uring). Usage is recomputed periodically by event loops, which respond to the level of pressure.
+    //
+    // Resident memory of the process is not used, since it is not reduced by freeing (the allocator keeps pages),
+    // so it would not show relief after sessions are closed; and kernel memory of sockets is not included in it.
+    class MemoryBudget : public boost::noncopyable
+    {
+    public:
+        // Levels of pressure, each one includes responses of the previous ones
+        enum class Level {
+            Normal,
+            // 75% of the budget: relay buffers are not enlarged, free buffers of the pool are deallocated
+            Constrained,
+            // 90% of the budget: connections are not accepted
+            Saturated,
+            // The budget is exceeded: the newest sessions are closed
+            Exceeded
+        };
+
+        struct Settings {
+            size_t budget;
+            // Memory reserved by a session besides relay buffers
+            size_t session_size;
+            // Memory reserved regardless of sessions
+            size_t fixed_size;
+        };
+
+    private:
+        const Settings m_settings;
+        std::atomic<size_t> m_usage;
+        std::atomic<Level> m_level;
+
+    public:
+        explicit MemoryBudget(const Settings& settings);
+
+    public:
+        // Recomputes usage and level by number of sessions and occupancy of the pool. Any thread may call it.
+        // Returns true, when level is changed.
+        bool update(size_t sessions_number) noexcept;
+
+        Level level() const noexcept {
+            return m_level.load(std::memory_order_relaxed);
+        }
+
+        size_t usage() const noexcept {
+            return m_usage.load(std::memory_order_relaxed);
+        }
+
+        size_t budget() const noexcept {
+            return m_settings.budget;
+        }
+
+        // Number of sessions, which must be closed to fit into the budget (rounded up)
+        size_t excess_sessions() const noexcept;
+
+        static const char* to_string(Level level) noexcept;
+    };
+}
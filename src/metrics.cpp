@@ -0,0 +1,297 @@
+#include "metrics.h"
+
+#include <progdn_core/buffer_pool.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace progdn
+{
+    namespace metrics {
+
+        static const size_t kCountersNumber = static_cast<size_t>(Counter::kCountersNumber);
+        static const size_t kGaugesNumber = static_cast<size_t>(Gauge::kGaugesNumber);
+        static const size_t kHistogramsNumber = static_cast<size_t>(Histogram::kHistogramsNumber);
+        static const size_t kMaximalBucketsNumber = 16;
+
+        struct CounterInfo {
+            const char* name;
+            const char* labels;
+            const char* help;
+        };
+
+        struct HistogramInfo {
+            const char* name;
+            const char* help;
+            // Upper bounds of buckets (microseconds), except of "+Inf"
+            std::array<uint64_t, kMaximalBucketsNumber> bounds;
+            size_t bounds_number;
+        };
+
+        // Order matches Counter. Counters with the same name must be adjacent.
+        static const std::array<CounterInfo, kCountersNumber> kCounters = {{
+            { "progdn_rvi_accepted_connections_total", "", "Accepted connections" },
+            { "progdn_rvi_accept_errors_total", "", "Failures to accept connection" },
+            { "progdn_rvi_throttled_accepts_total", "reason=\"max_sessions\"", "Pauses of accepting because of overload" },
+            { "progdn_rvi_throttled_accepts_total", "reason=\"open_files\"", "" },
+            { "progdn_rvi_throttled_accepts_total", "reason=\"memory\"", "" },
+            { "progdn_rvi_shed_connections_total", "", "Connections reset, since limit of open files was reached" },
+            { "progdn_rvi_event_loop_stalls_total", "", "Delays of event loops longer than stall threshold" },
+            // Error::None is not exported
+            { "progdn_rvi_header_errors_total", "reason=\"none\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"not_proxy_protocol\"", "Failures to receive PROXY header" },
+            { "progdn_rvi_header_errors_total", "reason=\"too_long_header\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"unsupported_version\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"unsupported_command\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"unsupported_protocol\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"malformed_address\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"malformed_port\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"malformed_header\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"read_error\"", "" },
+            { "progdn_rvi_header_errors_total", "reason=\"timeout\"", "" },
+            { "progdn_rvi_local_connections_total", "",
+              "Connections of the proxy itself (PROXY command LOCAL), closed without relaying" },
+            { "progdn_rvi_rejected_sessions_total", "reason=\"max_connections_per_ip\"",
+              "Sessions rejected before connecting to destination server" },
+            { "progdn_rvi_rejected_sessions_total", "reason=\"connect_rate_per_ip\"", "" },
+            { "progdn_rvi_rejected_sessions_total", "reason=\"destination_unavailable\"", "" },
+            { "progdn_rvi_untracked_sessions_total", "",
+              "Sessions not limited per source IP, since table of sources is full" },
+            { "progdn_rvi_connect_errors_total", "", "Failures to connect to destination server" },
+            { "progdn_rvi_circuit_breaker_trips_total", "",
+              "Destination servers considered unavailable after consecutive failures to connect" },
+            { "progdn_rvi_circuit_breaker_probes_total", "", "Sessions let through to unavailable destination servers" },
+            { "progdn_rvi_relayed_bytes_total", "direction=\"upstream\"",
+              "Payload relayed between client and destination server" },
+            { "progdn_rvi_relayed_bytes_total", "direction=\"downstream\"", "" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"header_timeout\"",
+              "Sessions closed by timeouts and memory pressure" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"idle_timeout\"", "" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"client_idle_timeout\"", "" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"server_idle_timeout\"", "" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"half_closed_timeout\"", "" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"lifetime_timeout\"", "" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"dead_peer\"", "" },
+            { "progdn_rvi_reaped_sessions_total", "reason=\"memory_pressure\"", "" },
+        }};
+
+        static const std::array<CounterInfo, kGaugesNumber> kGauges = {{
+            { "progdn_rvi_active_sessions", "", "Sessions in progress" },
+            { "progdn_rvi_paused_acceptors", "", "Threads, which do not accept connections because of overload" },
+            { "progdn_rvi_unavailable_destinations", "",
+              "Destination servers, to which sessions are not connected after failures" },
+            { "progdn_rvi_memory_usage_bytes", "", "Memory reserved by sessions and relay buffers (estimated)" },
+            { "progdn_rvi_memory_budget_bytes", "", "Limit of memory reserved by sessions and relay buffers" },
+        }};
+
+        static const std::array<HistogramInfo, kHistogramsNumber> kHistograms = {{
+            { "progdn_rvi_header_wait_seconds", "Time from accepting connection to receiving PROXY header",
+              {{ 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000 }},
+              15 },
+            { "progdn_rvi_connect_duration_seconds", "Time to connect to destination server",
+              {{ 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000 }},
+              15 },
+            { "progdn_rvi_first_response_byte_seconds",
+              "Time from connecting to destination server to its first payload",
+              {{ 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000,
+                 30000000 }},
+              15 },
+            { "progdn_rvi_session_duration_seconds", "Duration of sessions",
+              {{ 10000, 100000, 1000000, 5000000, 10000000, 30000000, 60000000, 300000000, 600000000, 1800000000,
+                 3600000000 }},
+              11 },
+            { "progdn_rvi_event_loop_lag_seconds", "Delay of periodic probe of event loops",
+              {{ 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000 }},
+              15 },
+        }};
+
+        // Metrics of a thread. Values are written by own thread only, and may be read by any thread.
+        struct Shard : public boost::noncopyable
+        {
+            struct HistogramData {
+                // The last bucket is "+Inf"
+                std::array<std::atomic<uint64_t>, kMaximalBucketsNumber + 1> buckets;
+                std::atomic<uint64_t> sum;
+            };
+
+            std::array<std::atomic<uint64_t>, kCountersNumber> counters;
+            // Signed values are stored as unsigned, so that sum of shards wraps correctly
+            std::array<std::atomic<uint64_t>, kGaugesNumber> gauges;
+            std::array<HistogramData, kHistogramsNumber> histograms;
+
+            Shard() {
+                for (auto& counter : counters)
+                    counter = 0;
+                for (auto& gauge : gauges)
+                    gauge = 0;
+                for (auto& histogram : histograms) {
+                    for (auto& bucket : histogram.buckets)
+                        bucket = 0;
+                    histogram.sum = 0;
+                }
+            }
+
+            // There is the only writer, so there is no need in atomic read-modify-write
+            static void increase(std::atomic<uint64_t>& value, uint64_t delta) noexcept {
+                value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+            }
+        };
+
+        // Shards are never deleted, so metrics of finished threads are kept
+        static std::mutex& shards_mutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        static std::vector<std::unique_ptr<Shard>>& shards() {
+            static std::vector<std::unique_ptr<Shard>> all_shards;
+            return all_shards;
+        }
+
+        static Shard& this_thread_shard() {
+            thread_local Shard* shard = nullptr;
+            if (!shard) {
+                std::lock_guard<std::mutex> lock(shards_mutex());
+                shards().emplace_back(new Shard());
+                shard = shards().back().get();
+            }
+            return *shard;
+        }
+
+        void add(Counter counter, uint64_t value) noexcept {
+            try {
+                Shard::increase(this_thread_shard().counters[static_cast<size_t>(counter)], value);
+            } catch (...) {}
+        }
+
+        void add(Gauge gauge, int64_t delta) noexcept {
+            try {
+                Shard::increase(this_thread_shard().gauges[static_cast<size_t>(gauge)], static_cast<uint64_t>(delta));
+            } catch (...) {}
+        }
+
+        void observe(Histogram histogram, Duration value) noexcept {
+            try {
+                const auto& info = kHistograms[static_cast<size_t>(histogram)];
+                auto& data = this_thread_shard().histograms[static_cast<size_t>(histogram)];
+                auto microseconds = static_cast<uint64_t>(std::max<Duration::rep>(value.count(), 0));
+                size_t bucket = 0;
+                while (bucket < info.bounds_number && microseconds > info.bounds[bucket])
+                    ++bucket;
+                Shard::increase(data.buckets[bucket], 1);
+                Shard::increase(data.sum, microseconds);
+            } catch (...) {}
+        }
+
+        uint64_t value(Counter counter) noexcept {
+            uint64_t result = 0;
+            std::lock_guard<std::mutex> lock(shards_mutex());
+            for (const auto& shard : shards())
+                result += shard->counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+            return result;
+        }
+
+        int64_t value(Gauge gauge) noexcept {
+            uint64_t result = 0;
+            std::lock_guard<std::mutex> lock(shards_mutex());
+            for (const auto& shard : shards())
+                result += shard->gauges[static_cast<size_t>(gauge)].load(std::memory_order_relaxed);
+            return static_cast<int64_t>(result);
+        }
+
+        static void write_header(std::ostream& stream, const char* name, const char* help, const char* type) {
+            stream << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+        }
+
+        // Microseconds as seconds, exactly (default precision of stream would round large sums to 6 digits)
+        static void write_seconds(std::ostream& stream, uint64_t microseconds) {
+            stream << microseconds / 1000000;
+            auto fraction = microseconds % 1000000;
+            if (fraction == 0)
+                return;
+            auto digits = std::to_string(1000000 + fraction).substr(1);
+            stream << '.' << digits.substr(0, digits.find_last_not_of('0') + 1);
+        }
+
+        static void write_sample(std::ostream& stream, const char* name, const char* labels, uint64_t value) {
+            stream << name;
+            if (*labels)
+                stream << '{' << labels << '}';
+            stream << ' ' << value << '\n';
+        }
+
+        std::string to_prometheus_text() {
+            std::ostringstream stream;
+
+            const char* previous_name = "";
+            for (size_t i = 0; i < kCountersNumber; ++i) {
+                const auto& info = kCounters[i];
+                if (static_cast<Counter>(i) == header_error(haproxy_protocol::Error::None))
+                    continue;
+                if (std::string(info.name) != previous_name)
+                    write_header(stream, info.name, info.help, "counter");
+                previous_name = info.name;
+                write_sample(stream, info.name, info.labels, value(static_cast<Counter>(i)));
+            }
+
+            for (size_t i = 0; i < kGaugesNumber; ++i) {
+                const auto& info = kGauges[i];
+                write_header(stream, info.name, info.help, "gauge");
+                write_sample(stream, info.name, info.labels,
+                             static_cast<uint64_t>(std::max<int64_t>(value(static_cast<Gauge>(i)), 0)));
+            }
+
+            auto occupancy = BufferPool::occupancy();
+            write_header(stream, "progdn_rvi_relay_buffers", "Relay buffers in the pool", "gauge");
+            for (size_t i = 0; i < BufferPool::kSizeClassesNumber; ++i) {
+                auto size = std::to_string(BufferPool::size_of(static_cast<BufferPool::SizeClass>(i)));
+                write_sample(stream, "progdn_rvi_relay_buffers", ("state=\"borrowed\",size=\"" + size + '"').c_str(),
+                             occupancy.borrowed[i]);
+                write_sample(stream, "progdn_rvi_relay_buffers", ("state=\"free\",size=\"" + size + '"').c_str(),
+                             occupancy.free[i]);
+            }
+
+            for (size_t i = 0; i < kHistogramsNumber; ++i) {
+                const auto& info = kHistograms[i];
+                std::array<uint64_t, kMaximalBucketsNumber + 1> buckets = {};
+                uint64_t sum = 0;
+                {
+                    std::lock_guard<std::mutex> lock(shards_mutex());
+                    for (const auto& shard : shards()) {
+                        const auto& data = shard->histograms[i];
+                        for (size_t bucket = 0; bucket <= info.bounds_number; ++bucket)
+                            buckets[bucket] += data.buckets[bucket].load(std::memory_order_relaxed);
+                        sum += data.sum.load(std::memory_order_relaxed);
+                    }
+                }
+
+                write_header(stream, info.name, info.help, "histogram");
+                auto bucket_name = std::string(info.name) + "_bucket";
+                uint64_t cumulative_count = 0;
+                for (size_t bucket = 0; bucket <= info.bounds_number; ++bucket) {
+                    cumulative_count += buckets[bucket];
+                    std::ostringstream labels;
+                    if (bucket < info.bounds_number) {
+                        labels << "le=\"";
+                        write_seconds(labels, info.bounds[bucket]);
+                        labels << '"';
+                    } else
+                        labels << "le=\"+Inf\"";
+                    write_sample(stream, bucket_name.c_str(), labels.str().c_str(), cumulative_count);
+                }
+                stream << info.name << "_sum ";
+                write_seconds(stream, sum);
+                stream << '\n';
+                write_sample(stream, (std::string(info.name) + "_count").c_str(), "", cumulative_count);
+            }
+            return stream.str();
+        }
+    }
+}
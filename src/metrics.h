@@ -0,0 +1,102 @@
+#pragma once
+
+#include "haproxy_protocol.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace progdn
+{
+    // Counters, gauges and histograms of the server.
+    // Each thread updates own shard without locks and atomic read-modify-write operations; shards are summed up,
+    // when metrics are exported.
+    namespace metrics {
+
+        enum class Counter {
+            AcceptedConnections,
+            AcceptErrors,
+            // Pauses of accepting by limit of sessions / by limit of open files
+            AcceptsThrottledBySessions,
+            AcceptsThrottledByOpenFiles,
+            // Pauses of accepting, while memory budget is nearly spent (see MemoryBudget)
+            AcceptsThrottledByMemory,
+            // Connections reset at once, since there was no descriptor to serve them
+            ShedConnections,
+            // Delays of event loop longer than "stall_threshold"
+            EventLoopStalls,
+            // Failures to receive PROXY header by reason (order matches haproxy_protocol::Error)
+            HeaderErrors,
+            HeaderErrorsEnd = HeaderErrors + static_cast<size_t>(haproxy_protocol::Error::kErrorsNumber),
+            HeaderReadErrors = HeaderErrorsEnd,
+            HeaderTimeouts,
+            // Connections of the proxy itself (command LOCAL of PROXY protocol version 2, for example, health checks)
+            LocalConnections,
+            // Sessions rejected by limits per source IP (see AdmissionControl)
+            AdmissionRejectedByConnections,
+            AdmissionRejectedByRate,
+            // Sessions rejected, since their destination server is unavailable (see CircuitBreaker)
+            DestinationUnavailable,
+            // Sessions admitted without limits, since their source cannot be tracked (table is full)
+            AdmissionUntracked,
+            ConnectErrors,
+            // Destination servers considered unavailable after consecutive failures to connect, and probes of them
+            CircuitBreakerTrips,
+            CircuitBreakerProbes,
+            BytesUpstream,
+            BytesDownstream,
+            // Sessions closed by server by reason (order matches Session::ReapReason)
+            ReapedSessions,
+            ReapedSessionsEnd = ReapedSessions + 8,
+            kCountersNumber = ReapedSessionsEnd
+        };
+
+        // Counter inside of a range (for example, by reason)
+        inline Counter operator+(Counter counter, size_t offset) noexcept {
+            return static_cast<Counter>(static_cast<size_t>(counter) + offset);
+        }
+
+        enum class Gauge {
+            ActiveSessions,
+            // Threads, which do not accept connections because of overload
+            PausedAcceptors,
+            // Destination servers, to which sessions are not connected after consecutive failures
+            UnavailableDestinations,
+            // Memory reserved by sessions and relay buffers (estimated, see MemoryBudget) and its limit, in bytes
+            MemoryUsage,
+            MemoryBudget,
+            kGaugesNumber
+        };
+
+        enum class Histogram {
+            // Time from accepting to receiving PROXY header
+            HeaderWait,
+            // Time to connect to destination server
+            ConnectLatency,
+            // Time from connecting to the first payload from destination server
+            FirstResponseByte,
+            SessionDuration,
+            // Delay of periodic probe of event loop (time, for which other work kept the loop busy)
+            EventLoopLag,
+            kHistogramsNumber
+        };
+
+        using Duration = std::chrono::microseconds;
+
+        void add(Counter counter, uint64_t value = 1) noexcept;
+        void add(Gauge gauge, int64_t delta) noexcept;
+        void observe(Histogram histogram, Duration value) noexcept;
+
+        inline Counter header_error(haproxy_protocol::Error error) noexcept {
+            return Counter::HeaderErrors + static_cast<size_t>(error);
+        }
+
+        // Sum of all threads
+        uint64_t value(Counter counter) noexcept;
+        int64_t value(Gauge gauge) noexcept;
+
+        // All metrics in Prometheus text exposition format
+        std::string to_prometheus_text();
+    }
+}
@@ -0,0 +1,97 @@
+#include <progdn_core/async_log_writer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace progdn
+{
+    const size_t AsyncLogWriter::kMaximalTextSize;
+    const size_t AsyncLogWriter::kDefaultCapacity;
+
+    AsyncLogWriter::AsyncLogWriter(std::unique_ptr<Log::Writer> writer, size_t capacity) :
+        m_writer(std::move(writer)),
+        m_records(capacity),
+        m_dropped_records(0),
+        m_is_stop_requested(false),
+        m_is_consumer_sleeping(false)
+    {
+    }
+
+    AsyncLogWriter::~AsyncLogWriter()
+    {
+        if (m_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_is_stop_requested = true;
+            }
+            m_condition.notify_one();
+            m_thread.join();
+        }
+    }
+
+    void AsyncLogWriter::start()
+    {
+        if (!m_thread.joinable())
+            m_thread = std::thread(&AsyncLogWriter::run, this);
+    }
+
+    void AsyncLogWriter::write(Level level, boost::string_view text)
+    {
+        if (!m_thread.joinable()) {
+            m_writer->write(level, text);
+            return;
+        }
+        auto is_enqueued = m_records.try_enqueue([&](Record& record) {
+            record.level = level;
+            record.size = std::min(text.size(), kMaximalTextSize);
+            std::memcpy(record.text, text.data(), record.size);
+        });
+        if (!is_enqueued) {
+            m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        // Notification without the mutex may be missed, but then consumer wakes up by timeout
+        if (m_is_consumer_sleeping.load(std::memory_order_seq_cst))
+            m_condition.notify_one();
+    }
+
+    bool AsyncLogWriter::try_dequeue_and_write()
+    {
+        return m_records.try_dequeue([this](Record& record) {
+            m_writer->write(record.level, boost::string_view(record.text, record.size));
+        });
+    }
+
+    void AsyncLogWriter::run()
+    {
+        // Consumer wakes up periodically as well, since notification may be missed by a producer
+        static const std::chrono::milliseconds kMaximalSleepTime(100);
+
+        uint64_t reported_dropped_records = 0;
+        while (true)
+        {
+            while (try_dequeue_and_write()) {}
+
+            auto dropped = dropped_records();
+            if (dropped != reported_dropped_records) {
+                try {
+                    m_writer->write(Level::Warning,
+                                    "Log queue is full, dropped records: " + std::to_string(dropped - reported_dropped_records));
+                } catch (...) {}
+                reported_dropped_records = dropped;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_is_stop_requested)
+                break;
+            m_is_consumer_sleeping.store(true, std::memory_order_seq_cst);
+            if (m_records.is_empty())
+                m_condition.wait_for(lock, kMaximalSleepTime);
+            m_is_consumer_sleeping.store(false, std::memory_order_relaxed);
+        }
+
+        // Rest of records are written on stop
+        while (try_dequeue_and_write()) {}
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <progdn_core/bounded_mpsc_queue.h>
+#include <progdn_core/log.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace progdn
+{
+    // Writer, which passes records to another (slow) writer through a dedicated thread, so that threads, which log,
+    // never block on it. Records are copied to a bounded lock-free queue; they are dropped (and counted), when the
+    // queue is full. Texts longer than kMaximalTextSize are truncated.
+    class AsyncLogWriter : public Log::Writer, public boost::noncopyable
+    {
+    public:
+        static const size_t kMaximalTextSize = Log::Record::kMaximalSize;
+        static const size_t kDefaultCapacity = 2048;
+
+    private:
+        struct Record {
+            Level level;
+            size_t size;
+            char text[kMaximalTextSize];
+        };
+
+    private:
+        std::unique_ptr<Log::Writer> m_writer;
+        BoundedMpscQueue<Record> m_records;
+        std::atomic<uint64_t> m_dropped_records;
+
+        std::thread m_thread;
+        std::atomic<bool> m_is_stop_requested;
+        // Consumer sleeps on condition, when queue is empty. Producers notify it only, when it sleeps.
+        std::atomic<bool> m_is_consumer_sleeping;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+
+    public:
+        // Capacity is rounded up to a power of 2
+        explicit AsyncLogWriter(std::unique_ptr<Log::Writer> writer, size_t capacity = kDefaultCapacity);
+        virtual ~AsyncLogWriter();
+
+    public:
+        // Starts the thread of writing. Until then, records are written synchronously (for example, before daemon(),
+        // since threads do not survive fork).
+        void start();
+
+        uint64_t dropped_records() const noexcept {
+            return m_dropped_records.load(std::memory_order_relaxed);
+        }
+
+    private:
+        virtual void write(Level level, boost::string_view text) override;
+        bool try_dequeue_and_write();
+        void run();
+    };
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Boost.Asio 1.74 uses std::exchange in awaitable.hpp without including <utility>
+#include <utility>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+namespace progdn
+{
+    // Stackless coroutine: its state is a heap frame of the size of its local variables
+    template<typename T = void>
+    using Awaitable = boost::asio::awaitable<T>;
+
+    // Completion token, which stores error into "error" instead of throwing
+    inline boost::asio::redirect_error_t<boost::asio::use_awaitable_t<>> with_error(boost::system::error_code& error)
+    {
+        return boost::asio::redirect_error(boost::asio::use_awaitable, error);
+    }
+}
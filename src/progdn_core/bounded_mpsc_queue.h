@@ -0,0 +1,92 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace progdn
+{
+    // Bounded lock-free queue of D. Vyukov (MPMC) used by many producers and a single consumer.
+    // Elements are filled and consumed in place by functors, so that large elements are not copied twice.
+    template<typename T>
+    class BoundedMpscQueue : public boost::noncopyable
+    {
+    private:
+        struct Cell {
+            // Equals to position of the cell, when it is free for a producer, and to position + 1, when it is
+            // filled for the consumer
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+    private:
+        std::unique_ptr<Cell[]> m_cells;
+        const size_t m_capacity_mask;
+        alignas(64) std::atomic<size_t> m_enqueue_position;
+        alignas(64) size_t m_dequeue_position = 0;
+
+    public:
+        // Capacity is rounded up to a power of 2
+        explicit BoundedMpscQueue(size_t capacity) :
+            m_cells(new Cell[round_up_to_power_of_2(capacity)]),
+            m_capacity_mask(round_up_to_power_of_2(capacity) - 1),
+            m_enqueue_position(0)
+        {
+            for (size_t i = 0; i <= m_capacity_mask; ++i)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+    public:
+        // Calls "fill(T&)" for a free element. Returns false, when the queue is full.
+        template<typename Fill>
+        bool try_enqueue(Fill&& fill) noexcept {
+            auto position = m_enqueue_position.load(std::memory_order_relaxed);
+            while (true)
+            {
+                auto& cell = m_cells[position & m_capacity_mask];
+                auto sequence = cell.sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (difference == 0) {
+                    if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        fill(cell.value);
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = m_enqueue_position.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Consumer only: calls "consume(T&)" for the oldest element. Returns false, when the queue is empty.
+        template<typename Consume>
+        bool try_dequeue(Consume&& consume) {
+            auto& cell = m_cells[m_dequeue_position & m_capacity_mask];
+            if (cell.sequence.load(std::memory_order_acquire) != m_dequeue_position + 1)
+                return false;
+            try { consume(cell.value); } catch (...) {}
+            cell.sequence.store(m_dequeue_position + m_capacity_mask + 1, std::memory_order_release);
+            ++m_dequeue_position;
+            return true;
+        }
+
+        // Consumer only
+        bool is_empty() const noexcept {
+            const auto& cell = m_cells[m_dequeue_position & m_capacity_mask];
+            return (cell.sequence.load(std::memory_order_acquire) != m_dequeue_position + 1);
+        }
+
+    private:
+        static size_t round_up_to_power_of_2(size_t value) noexcept {
+            size_t result = 2;
+            while (result < value)
+                result <<= 1;
+            return result;
+        }
+    };
+}
@@ -0,0 +1,163 @@
+#include <progdn_core/buffer_pool.h>
+
+#include <algorithm>
+#include <mutex>
+
+namespace progdn
+{
+    constexpr size_t BufferPool::kSmallBufferSize;
+    constexpr size_t BufferPool::kLargeBufferSize;
+    std::atomic<size_t> BufferPool::m_free_list_capacity(1024);
+
+    // Free lists of a thread. Counters are written by own thread only, and may be read by any thread.
+    class BufferPool::ThreadCache : public boost::noncopyable
+    {
+    private:
+        std::array<std::vector<char*>, kSizeClassesNumber> m_free_lists;
+        std::array<std::atomic<size_t>, kSizeClassesNumber> m_borrowed;
+        std::array<std::atomic<size_t>, kSizeClassesNumber> m_free;
+
+    public:
+        ThreadCache() {
+            for (size_t i = 0; i < kSizeClassesNumber; ++i) {
+                m_borrowed[i] = 0;
+                m_free[i] = 0;
+            }
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            registry().push_back(this);
+        }
+
+        ~ThreadCache() {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            auto& caches = registry();
+            caches.erase(std::remove(caches.begin(), caches.end(), this), caches.end());
+            // Buffers still in use will be released by other threads
+            for (size_t i = 0; i < kSizeClassesNumber; ++i) {
+                orphans()[i] += m_borrowed[i].load(std::memory_order_relaxed);
+                for (auto data : m_free_lists[i])
+                    delete[] data;
+            }
+        }
+
+    public:
+        static ThreadCache& get() {
+            thread_local ThreadCache cache;
+            return cache;
+        }
+
+        char* borrow(SizeClass size_class) {
+            auto& free_list = m_free_lists[size_class];
+            char* data;
+            if (free_list.empty()) {
+                data = new char[size_of(size_class)];
+            } else {
+                data = free_list.back();
+                free_list.pop_back();
+                decrement(m_free[size_class]);
+            }
+            increment(m_borrowed[size_class]);
+            return data;
+        }
+
+        void release(char* data, SizeClass size_class) noexcept {
+            decrement(m_borrowed[size_class]);
+            auto& free_list = m_free_lists[size_class];
+            try {
+                if (free_list.size() < m_free_list_capacity.load(std::memory_order_relaxed)) {
+                    free_list.push_back(data);
+                    increment(m_free[size_class]);
+                    return;
+                }
+            } catch (...) {}
+            delete[] data;
+        }
+
+        void release_free_buffers() noexcept {
+            for (size_t i = 0; i < kSizeClassesNumber; ++i) {
+                for (auto data : m_free_lists[i])
+                    delete[] data;
+                m_free_lists[i].clear();
+                m_free[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        static Occupancy occupancy() {
+            Occupancy result;
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            for (size_t i = 0; i < kSizeClassesNumber; ++i)
+                result.borrowed[i] = orphans()[i];
+            for (auto cache : registry()) {
+                for (size_t i = 0; i < kSizeClassesNumber; ++i) {
+                    // Buffers released by other threads may make counter of a single thread "negative"
+                    result.borrowed[i] += cache->m_borrowed[i].load(std::memory_order_relaxed);
+                    result.free[i] += cache->m_free[i].load(std::memory_order_relaxed);
+                }
+            }
+            return result;
+        }
+
+    private:
+        // Counter is modified by own thread only, so there is no need in atomic read-modify-write
+        static void increment(std::atomic<size_t>& counter) noexcept {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        static void decrement(std::atomic<size_t>& counter) noexcept {
+            counter.store(counter.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+
+        static std::mutex& registry_mutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        static std::vector<ThreadCache*>& registry() {
+            static std::vector<ThreadCache*> caches;
+            return caches;
+        }
+
+        static std::array<size_t, kSizeClassesNumber>& orphans() {
+            static std::array<size_t, kSizeClassesNumber> counters = {};
+            return counters;
+        }
+    };
+
+    BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            m_data = other.m_data;
+            m_size_class = other.m_size_class;
+            other.m_data = nullptr;
+        }
+        return *this;
+    }
+
+    void BufferPool::Buffer::release() noexcept
+    {
+        if (m_data) {
+            ThreadCache::get().release(m_data, m_size_class);
+            m_data = nullptr;
+        }
+    }
+
+    BufferPool::Buffer BufferPool::borrow(SizeClass size_class)
+    {
+        return Buffer(ThreadCache::get().borrow(size_class), size_class);
+    }
+
+    BufferPool::Occupancy BufferPool::occupancy()
+    {
+        return ThreadCache::occupancy();
+    }
+
+    void BufferPool::set_free_list_capacity(size_t capacity) noexcept
+    {
+        m_free_list_capacity = capacity;
+    }
+
+    void BufferPool::release_free_buffers() noexcept
+    {
+        ThreadCache::get().release_free_buffers();
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace progdn
+{
+    // Pool of fixed-size buffers with free lists per thread.
+    // Buffer is returned to the free list of the thread, which releases it, so there are no locks, when buffers are
+    // borrowed and released within the same thread.
+    class BufferPool
+    {
+    public:
+        enum SizeClass { Small, Large, kSizeClassesNumber };
+
+        static constexpr size_t kSmallBufferSize = 8 * 1024;
+        static constexpr size_t kLargeBufferSize = 64 * 1024;
+
+        // Owner of a borrowed buffer, which returns it to the pool on destruction
+        class Buffer : public boost::noncopyable
+        {
+        private:
+            char* m_data = nullptr;
+            SizeClass m_size_class = Small;
+
+        public:
+            Buffer() = default;
+            Buffer(char* data, SizeClass size_class) noexcept : m_data(data), m_size_class(size_class) {}
+            Buffer(Buffer&& other) noexcept : m_data(other.m_data), m_size_class(other.m_size_class) {
+                other.m_data = nullptr;
+            }
+            ~Buffer() {
+                release();
+            }
+
+        public:
+            Buffer& operator=(Buffer&& other) noexcept;
+            void release() noexcept;
+
+            char* data() const noexcept {
+                return m_data;
+            }
+
+            size_t size() const noexcept {
+                return BufferPool::size_of(m_size_class);
+            }
+
+            SizeClass size_class() const noexcept {
+                return m_size_class;
+            }
+        };
+
+        struct Occupancy
+        {
+            // Buffers in use
+            std::array<size_t, kSizeClassesNumber> borrowed = {};
+            // Buffers in free lists
+            std::array<size_t, kSizeClassesNumber> free = {};
+        };
+
+    public:
+        static Buffer borrow(SizeClass size_class);
+
+        // Sum of all threads
+        static Occupancy occupancy();
+
+        // Maximal number of free buffers of each size kept by each thread (extra ones are deallocated)
+        static void set_free_list_capacity(size_t capacity) noexcept;
+
+        // Deallocates free buffers of the calling thread (for example, under memory pressure)
+        static void release_free_buffers() noexcept;
+
+        static constexpr size_t size_of(SizeClass size_class) noexcept {
+            return (size_class == Large ? kLargeBufferSize : kSmallBufferSize);
+        }
+
+    private:
+        class ThreadCache;
+        static std::atomic<size_t> m_free_list_capacity;
+    };
+}
@@ -0,0 +1,76 @@
+#include <progdn_core/cpu_affinity.h>
+
+#include <sched.h>
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace progdn
+{
+    namespace
+    {
+        unsigned parse_cpu(const std::string& str)
+        {
+            size_t size = 0;
+            unsigned long cpu = 0;
+            try {
+                cpu = std::stoul(str, &size);
+            } catch (const std::exception&) {
+                size = 0;
+            }
+            if (size == 0 || size != str.size())
+                throw std::runtime_error("'" + str + "' is not a CPU number");
+            if (cpu >= CPU_SETSIZE)
+                throw std::runtime_error("CPU number " + str + " is too big");
+            return static_cast<unsigned>(cpu);
+        }
+    }
+
+    std::vector<unsigned> CpuAffinity::parse_list(const std::string& str)
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            auto error = errno;
+            throw std::runtime_error(std::string("Cannot get CPU affinity of the process: ") + strerror(error));
+        }
+        std::vector<unsigned> cpus;
+        if (boost::algorithm::trim_copy(str) == "auto") {
+            for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+            }
+            return cpus;
+        }
+
+        std::vector<std::string> items;
+        boost::algorithm::split(items, str, [](char c) { return c == ','; });
+        for (auto& item : items) {
+            boost::algorithm::trim(item);
+            auto dash = item.find('-');
+            auto first = parse_cpu(boost::algorithm::trim_copy(item.substr(0, dash)));
+            auto last = (dash == std::string::npos) ? first : parse_cpu(boost::algorithm::trim_copy(item.substr(dash + 1)));
+            if (last < first)
+                throw std::runtime_error("'" + item + "' is not a range of CPUs");
+            for (auto cpu = first; cpu <= last; ++cpu) {
+                if (!CPU_ISSET(cpu, &allowed))
+                    throw std::runtime_error("CPU " + std::to_string(cpu) + " is not available to the process");
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    int CpuAffinity::pin_thread(pthread_t thread, unsigned cpu) noexcept
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        // Returns error instead of setting errno
+        return ::pthread_setaffinity_np(thread, sizeof(set), &set);
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+namespace progdn
+{
+    class CpuAffinity
+    {
+    public:
+        // List of CPUs in the format of cpuset(7): "0-3,8,10-11" (in the order of the list).
+        // "auto" - CPUs, on which the process is allowed to run (others are not accepted in the list either).
+        static std::vector<unsigned> parse_list(const std::string& str);
+
+        // Returns errno on failure (and 0 on success)
+        static int pin_thread(pthread_t thread, unsigned cpu) noexcept;
+    };
+}
@@ -0,0 +1,306 @@
+#include <progdn_core/io_uring.h>
+
+#include <boost/asio/post.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace progdn
+{
+    static boost::system::system_error make_system_error(int error, const char* what)
+    {
+        return boost::system::system_error(error, boost::system::system_category(), what);
+    }
+
+    IoUring::BufferGroup::BufferGroup(IoUring& ring, uint16_t id, size_t buffer_size, uint16_t buffers_number) :
+        m_ring(ring),
+        m_id(id),
+        m_buffer_size(buffer_size),
+        m_buffers_number(buffers_number),
+        m_memory(new char[buffer_size * buffers_number])
+    {
+        // Giving back never allocates
+        m_returned_buffers.reserve(buffers_number);
+        // Receive operations of the group fail, if buffers are not provided, so failure is reported at once
+        auto memory = m_memory.get();
+        auto result = m_ring.submit_and_wait([this, memory](io_uring_sqe& entry) {
+            entry.opcode = IORING_OP_PROVIDE_BUFFERS;
+            entry.fd = m_buffers_number;
+            entry.addr = reinterpret_cast<uintptr_t>(memory);
+            entry.len = static_cast<uint32_t>(m_buffer_size);
+            entry.off = 0;
+            entry.buf_group = m_id;
+        });
+        if (result < 0)
+            throw make_system_error(-result, "IORING_OP_PROVIDE_BUFFERS");
+        m_ring.m_buffer_groups.push_back(this);
+    }
+
+    IoUring::BufferGroup::~BufferGroup()
+    {
+        auto& groups = m_ring.m_buffer_groups;
+        groups.erase(std::remove(groups.begin(), groups.end(), this), groups.end());
+    }
+
+    void IoUring::BufferGroup::give_back(uint16_t buffer_id) noexcept
+    {
+        // Order of buffers does not matter, but the queue is not bypassed, so it is not held for long
+        if (!m_returned_buffers.empty() || !provide(buffer_id))
+            m_returned_buffers.push_back(buffer_id);
+    }
+
+    bool IoUring::BufferGroup::provide(uint16_t buffer_id) noexcept
+    {
+        auto buffer = data(buffer_id);
+        try {
+            m_ring.submit_detached([this, buffer, buffer_id](io_uring_sqe& entry) {
+                entry.opcode = IORING_OP_PROVIDE_BUFFERS;
+                entry.fd = 1;
+                entry.addr = reinterpret_cast<uintptr_t>(buffer);
+                entry.len = static_cast<uint32_t>(m_buffer_size);
+                entry.off = buffer_id;
+                entry.buf_group = m_id;
+            });
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+
+    void IoUring::BufferGroup::give_back_returned() noexcept
+    {
+        while (!m_returned_buffers.empty() && provide(m_returned_buffers.back()))
+            m_returned_buffers.pop_back();
+    }
+
+    IoUring::IoUring(boost::asio::io_context& io_context, unsigned entries, unsigned completions) :
+        m_io_context(io_context),
+        m_event(io_context)
+    {
+        std::memset(&m_params, 0, sizeof(m_params));
+        // Completion queue is larger, since operations of relay may wait for long
+        m_params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+        m_params.cq_entries = std::max(completions, entries * 2);
+        m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &m_params));
+        if (m_fd < 0)
+            throw make_system_error(errno, "io_uring_setup");
+
+        m_sq_ring_size = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+        auto is_single_mmap = (m_params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (is_single_mmap)
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+
+        auto map = [this](size_t size, off_t offset) {
+            auto memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+            if (memory == MAP_FAILED) {
+                auto error = errno;
+                unmap();
+                throw make_system_error(error, "mmap of io_uring");
+            }
+            return memory;
+        };
+        m_sq_ring = map(m_sq_ring_size, IORING_OFF_SQ_RING);
+        m_cq_ring = is_single_mmap ? m_sq_ring : map(m_cq_ring_size, IORING_OFF_CQ_RING);
+        m_entries = static_cast<io_uring_sqe*>(map(m_params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+
+        auto sq = static_cast<char*>(m_sq_ring);
+        m_sq_head = reinterpret_cast<unsigned*>(sq + m_params.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + m_params.sq_off.tail);
+        m_sq_flags = reinterpret_cast<unsigned*>(sq + m_params.sq_off.flags);
+        m_sq_array = reinterpret_cast<unsigned*>(sq + m_params.sq_off.array);
+        auto cq = static_cast<char*>(m_cq_ring);
+        m_cq_head = reinterpret_cast<unsigned*>(cq + m_params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + m_params.cq_off.tail);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + m_params.cq_off.cqes);
+
+        auto event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            auto error = errno;
+            unmap();
+            throw make_system_error(error, "eventfd");
+        }
+        m_event.assign(event_fd);
+        if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+            auto error = errno;
+            unmap();
+            throw make_system_error(error, "io_uring_register");
+        }
+        try {
+            probe_operations();
+        } catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    void IoUring::probe_operations()
+    {
+        static const uint8_t kRequiredOperations[] = { IORING_OP_RECV, IORING_OP_SEND, IORING_OP_PROVIDE_BUFFERS };
+
+        // Probe itself is supported since Linux 5.6, so older kernels fail here too
+        std::vector<char> memory(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op), 0);
+        auto probe = reinterpret_cast<io_uring_probe*>(memory.data());
+        if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0)
+            throw make_system_error(errno, "io_uring_register(IORING_REGISTER_PROBE)");
+        for (auto operation : kRequiredOperations) {
+            if (operation > probe->last_op || !(probe->ops[operation].flags & IO_URING_OP_SUPPORTED))
+                throw make_system_error(EOPNOTSUPP, ("io_uring operation " + std::to_string(operation)).c_str());
+        }
+    }
+
+    IoUring::~IoUring()
+    {
+        // Kernel cancels operations on closing of the ring
+        unmap();
+        while (m_pending_operations) {
+            auto operation = m_pending_operations;
+            remove_pending(operation);
+            delete operation;
+        }
+    }
+
+    void IoUring::unmap() noexcept
+    {
+        if (m_entries)
+            ::munmap(m_entries, m_params.sq_entries * sizeof(io_uring_sqe));
+        if (m_cq_ring && m_cq_ring != m_sq_ring)
+            ::munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring)
+            ::munmap(m_sq_ring, m_sq_ring_size);
+        m_entries = nullptr;
+        m_sq_ring = m_cq_ring = nullptr;
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+    }
+
+    io_uring_sqe& IoUring::get_entry()
+    {
+        auto tail = *m_sq_tail;
+        if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_params.sq_entries) {
+            // Queue is full, so queued entries are submitted right now
+            submit();
+            if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_params.sq_entries)
+                throw make_system_error(EBUSY, "io_uring submission queue is full");
+        }
+        auto index = tail & (m_params.sq_entries - 1);
+        auto& entry = m_entries[index];
+        std::memset(&entry, 0, sizeof(entry));
+        m_sq_array[index] = index;
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++m_entries_to_submit;
+
+        if (!m_is_submit_scheduled) {
+            m_is_submit_scheduled = true;
+            boost::asio::post(m_io_context, [this]() {
+                m_is_submit_scheduled = false;
+                try { submit(); } catch (...) {}
+            });
+        }
+        return entry;
+    }
+
+    void IoUring::add_pending(Operation* operation)
+    {
+        operation->next = m_pending_operations;
+        if (m_pending_operations)
+            m_pending_operations->prev = operation;
+        m_pending_operations = operation;
+        if (!m_is_waiting)
+            wait_for_completions();
+    }
+
+    void IoUring::remove_pending(Operation* operation) noexcept
+    {
+        if (operation->prev)
+            operation->prev->next = operation->next;
+        else
+            m_pending_operations = operation->next;
+        if (operation->next)
+            operation->next->prev = operation->prev;
+        operation->prev = operation->next = nullptr;
+    }
+
+    void IoUring::submit()
+    {
+        while (m_entries_to_submit > 0) {
+            auto submitted = ::syscall(__NR_io_uring_enter, m_fd, m_entries_to_submit, 0, 0, nullptr, 0);
+            if (submitted < 0) {
+                if (errno == EINTR)
+                    continue;
+                // Completion queue is overflown (EBUSY) or lack of memory: the rest is submitted later
+                if (errno == EBUSY || errno == EAGAIN)
+                    return;
+                throw make_system_error(errno, "io_uring_enter");
+            }
+            m_entries_to_submit -= static_cast<unsigned>(submitted);
+        }
+    }
+
+    void IoUring::wait_for_completions()
+    {
+        m_is_waiting = true;
+        m_event.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+            [this](const boost::system::error_code& error) {
+                m_is_waiting = false;
+                if (error == boost::asio::error::operation_aborted)
+                    return;
+                uint64_t counter;
+                while (::read(m_event.native_handle(), &counter, sizeof(counter)) < 0 && errno == EINTR) {}
+                reap_completions();
+                if (m_pending_operations && !m_is_waiting)
+                    wait_for_completions();
+            });
+    }
+
+    void IoUring::wait_until(const bool& is_completed)
+    {
+        submit();
+        while (!is_completed) {
+            if (::syscall(__NR_io_uring_enter, m_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                throw make_system_error(errno, "io_uring_enter");
+            reap_completions();
+        }
+    }
+
+    void IoUring::reap_completions()
+    {
+        while (true) {
+            auto head = *m_cq_head;
+            while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+                const auto& cqe = m_cqes[head & (m_params.cq_entries - 1)];
+                auto operation = reinterpret_cast<Operation*>(static_cast<uintptr_t>(cqe.user_data));
+                Completion completion = { cqe.res, cqe.flags };
+                __atomic_store_n(m_cq_head, ++head, __ATOMIC_RELEASE);
+                if (operation) {
+                    // Handler may queue new operations
+                    remove_pending(operation);
+                    std::unique_ptr<Operation> deleter(operation);
+                    try { operation->complete(completion); } catch (...) {}
+                }
+                head = *m_cq_head;
+            }
+            // Completions, which did not fit into the queue, are kept by the kernel, and new ones join them, until
+            // they are flushed by io_uring_enter() (eventfd is not signalled meanwhile)
+            if (!(__atomic_load_n(m_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+                break;
+            if (::syscall(__NR_io_uring_enter, m_fd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                break;
+        }
+        // Buffers and entries left after EBUSY
+        for (auto group : m_buffer_groups)
+            group->give_back_returned();
+        if (m_entries_to_submit > 0)
+            submit();
+    }
+}
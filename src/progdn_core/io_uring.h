@@ -0,0 +1,198 @@
+#pragma once
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace progdn
+{
+    // Submission and completion queues of io_uring(7) driven by io_context (liburing is not required).
+    // Operations, which are queued within a handler of io_context, are submitted at once by a single system call;
+    // completions are reaped, when eventfd attached to the ring becomes readable.
+    // Accessed from the thread of io_context only.
+    class IoUring : public boost::noncopyable
+    {
+    public:
+        struct Completion {
+            // Result of operation (negative errno is converted to error code)
+            int32_t result;
+            uint32_t flags;
+        };
+
+        // Buffers provided to the kernel (IORING_OP_PROVIDE_BUFFERS): receive operations with IOSQE_BUFFER_SELECT
+        // take a buffer only when data arrives, so waiting connections do not hold buffers
+        class BufferGroup : public boost::noncopyable
+        {
+        private:
+            IoUring& m_ring;
+            const uint16_t m_id;
+            const size_t m_buffer_size;
+            const uint16_t m_buffers_number;
+            std::unique_ptr<char[]> m_memory;
+            // Buffers, which are not given back yet, since submission queue was full
+            std::vector<uint16_t> m_returned_buffers;
+
+        public:
+            BufferGroup(IoUring& ring, uint16_t id, size_t buffer_size, uint16_t buffers_number);
+            ~BufferGroup();
+
+        public:
+            uint16_t id() const noexcept {
+                return m_id;
+            }
+
+            size_t buffer_size() const noexcept {
+                return m_buffer_size;
+            }
+
+            char* data(uint16_t buffer_id) const noexcept {
+                return m_memory.get() + m_buffer_size * buffer_id;
+            }
+
+            // Returns buffer selected by a completed operation to the kernel (later, if submission queue is full)
+            void give_back(uint16_t buffer_id) noexcept;
+
+        private:
+            friend class IoUring;
+            bool provide(uint16_t buffer_id) noexcept;
+            void give_back_returned() noexcept;
+        };
+
+    private:
+        // Queued operation, which is addressed by "user_data" of its entry.
+        // Operations are linked into a list, so that they are deleted with the ring, if they are not completed.
+        class Operation
+        {
+        public:
+            Operation* prev = nullptr;
+            Operation* next = nullptr;
+
+        public:
+            virtual ~Operation() = default;
+            virtual void complete(const Completion& completion) = 0;
+        };
+
+        template<typename Handler>
+        class HandlerOperation : public Operation
+        {
+        private:
+            Handler m_handler;
+
+        public:
+            explicit HandlerOperation(Handler&& handler) : m_handler(std::move(handler)) {}
+
+            virtual void complete(const Completion& completion) override {
+                boost::system::error_code error;
+                if (completion.result < 0)
+                    error.assign(-completion.result, boost::system::system_category());
+                m_handler(error, completion);
+            }
+        };
+
+        template<typename Prepare>
+        struct Initiation {
+            IoUring* ring;
+            Prepare prepare;
+
+            template<typename Handler>
+            void operator()(Handler&& handler) {
+                std::unique_ptr<Operation> operation(
+                    new HandlerOperation<typename std::decay<Handler>::type>(std::forward<Handler>(handler)));
+                auto& entry = ring->get_entry();
+                prepare(entry);
+                entry.user_data = reinterpret_cast<uintptr_t>(operation.get());
+                ring->add_pending(operation.release());
+            }
+        };
+
+    private:
+        boost::asio::io_context& m_io_context;
+        int m_fd = -1;
+        io_uring_params m_params;
+        // Memory shared with the kernel
+        void* m_sq_ring = nullptr;
+        size_t m_sq_ring_size = 0;
+        void* m_cq_ring = nullptr;
+        size_t m_cq_ring_size = 0;
+        io_uring_sqe* m_entries = nullptr;
+        // Pointers into the rings
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned* m_sq_flags;
+        unsigned* m_sq_array;
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        io_uring_cqe* m_cqes;
+        // Entries, which are queued, but not submitted yet
+        unsigned m_entries_to_submit = 0;
+        bool m_is_submit_scheduled = false;
+        // Eventfd, which is signalled on completions. It is waited only while there are pending operations,
+        // so the ring does not keep io_context running.
+        boost::asio::posix::stream_descriptor m_event;
+        bool m_is_waiting = false;
+        Operation* m_pending_operations = nullptr;
+        std::vector<BufferGroup*> m_buffer_groups;
+
+    public:
+        // "completions" - size of completion queue, it should fit operations of all sessions (it is clamped by the
+        // kernel, and completions beyond it are kept in overflow list of the kernel).
+        // Throws boost::system::system_error, when io_uring is not supported (or not permitted), or the kernel does not
+        // support operations of the relay (receive, send and provided buffers, Linux 5.7 or newer)
+        IoUring(boost::asio::io_context& io_context, unsigned entries, unsigned completions);
+        ~IoUring();
+
+    public:
+        // Queues operation prepared by "prepare(io_uring_sqe&)".
+        // Completion signature: void(boost::system::error_code, IoUring::Completion).
+        template<typename Prepare, typename CompletionToken>
+        BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, Completion))
+        async_submit(Prepare prepare, CompletionToken&& token) {
+            return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, Completion)>(
+                Initiation<Prepare>{this, std::move(prepare)}, token);
+        }
+
+        // Queues operation without completion handler
+        template<typename Prepare>
+        void submit_detached(Prepare prepare) {
+            auto& entry = get_entry();
+            prepare(entry);
+            entry.user_data = 0;
+        }
+
+        // Submits operation and blocks the thread until it is completed (for initialization).
+        // Returns result of the operation (negative errno on failure).
+        template<typename Prepare>
+        int32_t submit_and_wait(Prepare prepare) {
+            int32_t result = 0;
+            bool is_completed = false;
+            auto on_completion = [&result, &is_completed](const boost::system::error_code&, Completion completion) {
+                result = completion.result;
+                is_completed = true;
+            };
+            async_submit(std::move(prepare), std::move(on_completion));
+            wait_until(is_completed);
+            return result;
+        }
+
+    private:
+        io_uring_sqe& get_entry();
+        void add_pending(Operation* operation);
+        void remove_pending(Operation* operation) noexcept;
+        void submit();
+        void wait_for_completions();
+        void reap_completions();
+        void wait_until(const bool& is_completed);
+        void probe_operations();
+        void unmap() noexcept;
+    };
+}
@@ -1,6 +1,13 @@
 #pragma once
 
-#include <boost/asio.hpp>
+#include <boost/asio/detail/socket_ops.hpp>
+#include <boost/asio/ip/address_v4.hpp>
+
+#include <arpa/inet.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
 
 namespace progdn
 {
@@ -10,6 +17,9 @@ namespace progdn
 
         IP_Host() = default;
 
+        explicit IP_Host(const boost::asio::ip::address_v4& address) :
+            host(address.to_uint()) {}
+
         IP_Host(const char* serialized) {
             struct in_addr addr;
             if (!::inet_pton(AF_INET, serialized, &addr))
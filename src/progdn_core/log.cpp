@@ -1,7 +1,15 @@
 #include <progdn_core/log.h>
 
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstring>
+
 namespace progdn
 {
+    const size_t Log::Record::kMaximalSize;
+    std::atomic<int> Log::m_threshold(Log::Debug);
+
     const char* Log::Writer::to_string(Level level) noexcept
     {
         switch (level)
@@ -19,6 +27,73 @@ namespace progdn
         };
     }
 
+    Log::Record& Log::Record::append(boost::string_view text) noexcept
+    {
+        auto size = std::min(text.size(), kMaximalSize - m_size);
+        std::memcpy(m_text + m_size, text.data(), size);
+        m_size += size;
+        return *this;
+    }
+
+    Log::Record& Log::Record::append(char c) noexcept
+    {
+        if (m_size < kMaximalSize)
+            m_text[m_size++] = c;
+        return *this;
+    }
+
+    Log::Record& Log::Record::append(const boost::asio::ip::address& address) noexcept
+    {
+        char text[INET6_ADDRSTRLEN] = "";
+        if (address.is_v4()) {
+            auto bytes = address.to_v4().to_bytes();
+            ::inet_ntop(AF_INET, bytes.data(), text, sizeof(text));
+        } else {
+            auto bytes = address.to_v6().to_bytes();
+            ::inet_ntop(AF_INET6, bytes.data(), text, sizeof(text));
+        }
+        return append(text);
+    }
+
+    Log::Record& Log::Record::append(const boost::asio::ip::tcp::endpoint& endpoint) noexcept
+    {
+        if (endpoint.address().is_v6())
+            return append('[').append(endpoint.address()).append("]:").append(endpoint.port());
+        return append(endpoint.address()).append(':').append(endpoint.port());
+    }
+
+    Log::Record& Log::Record::append(const boost::system::error_code& error) noexcept
+    {
+        try {
+            return append(error.message());
+        } catch (...) {
+            return append("error ").append(error.value());
+        }
+    }
+
+    Log::Record& Log::Record::append_unsigned(unsigned long long value) noexcept
+    {
+        char digits[20];
+        size_t size = 0;
+        do {
+            digits[size++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        while (size > 0)
+            append(digits[--size]);
+        return *this;
+    }
+
+    Log::Level Log::parse_level(const std::string& name)
+    {
+        for (auto level : { Error, Warning, Info, Debug }) {
+            static const char* kNames[] = { "error", "warning", "info", "debug" };
+            if (name == kNames[level])
+                return level;
+        }
+        throw std::runtime_error("'" + name + "' is not a log level (expected 'error', 'warning', 'info' or 'debug')");
+    }
+
     void Log::debug(const std::string& messageText) noexcept
     {
         try_write(Level::Debug, messageText);
@@ -39,10 +114,12 @@ namespace progdn
         try_write(Level::Error, messageText);
     }
 
-    void Log::try_write(Level level, const std::string& text) noexcept
+    void Log::try_write(Level level, boost::string_view text) noexcept
     {
         try
         {
+            if (level > m_threshold.load(std::memory_order_relaxed))
+                return;
             auto& this_object = Log::get_instance_or_null();
             if (this_object) {
                 for (auto& writer : this_object->m_writers)
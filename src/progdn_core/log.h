@@ -2,12 +2,31 @@
 
 #include <progdn_core/singleton.h>
 
+#include <boost/asio/ip/tcp.hpp>
 #include <boost/format.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/utility/string_view.hpp>
 
+#include <atomic>
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+// Record is formatted only if its level is enabled, so arguments are not evaluated otherwise.
+// Example: PROGDN_LOG_INFO("Listen: ", endpoint, ", threads: ", threads);
+#define PROGDN_LOG(level, ...) \
+    do { \
+        if (::progdn::Log::is_enabled(::progdn::Log::level)) \
+            ::progdn::Log::write(::progdn::Log::level, __VA_ARGS__); \
+    } while (false)
+
+#define PROGDN_LOG_ERROR(...)   PROGDN_LOG(Error, __VA_ARGS__)
+#define PROGDN_LOG_WARNING(...) PROGDN_LOG(Warning, __VA_ARGS__)
+#define PROGDN_LOG_INFO(...)    PROGDN_LOG(Info, __VA_ARGS__)
+#define PROGDN_LOG_DEBUG(...)   PROGDN_LOG(Debug, __VA_ARGS__)
+
 namespace progdn
 {
     class Log : public Singleton<Log>
@@ -25,11 +44,68 @@ namespace progdn
             virtual ~Writer() = default;
 
         public:
-            virtual void write(Level level, const std::string& text) = 0;
+            virtual void write(Level level, boost::string_view text) = 0;
             static const char* to_string(Level level) noexcept;
         };
 
+        // Text of a record formatted on stack (truncated, when it does not fit).
+        // Other types are formatted by their method "void append_to(Log::Record&) const".
+        class Record
+        {
+        public:
+            static const size_t kMaximalSize = 480;
+
+        private:
+            char m_text[kMaximalSize];
+            size_t m_size = 0;
+
+        public:
+            boost::string_view text() const noexcept {
+                return boost::string_view(m_text, m_size);
+            }
+
+            Record& append(boost::string_view text) noexcept;
+            Record& append(char c) noexcept;
+            Record& append(const boost::asio::ip::address& address) noexcept;
+            Record& append(const boost::asio::ip::tcp::endpoint& endpoint) noexcept;
+            Record& append(const boost::system::error_code& error) noexcept;
+
+            Record& append(const char* text) noexcept {
+                return append(boost::string_view(text));
+            }
+
+            Record& append(const std::string& text) noexcept {
+                return append(boost::string_view(text));
+            }
+
+            template<typename T>
+            typename std::enable_if<std::is_integral<T>::value, Record&>::type append(T value) noexcept {
+                return std::is_signed<T>::value && value < 0
+                    ? append('-').append_unsigned(0 - static_cast<unsigned long long>(value))
+                    : append_unsigned(static_cast<unsigned long long>(value));
+            }
+
+            template<typename T>
+            typename std::enable_if<std::is_class<T>::value, Record&>::type append(const T& value) {
+                value.append_to(*this);
+                return *this;
+            }
+
+            void append_all() noexcept {}
+
+            template<typename T, typename... Arguments>
+            void append_all(const T& value, const Arguments&... arguments) {
+                append(value);
+                append_all(arguments...);
+            }
+
+        private:
+            Record& append_unsigned(unsigned long long value) noexcept;
+        };
+
     private:
+        // Records of levels above the threshold are not formatted
+        static std::atomic<int> m_threshold;
         std::vector<std::unique_ptr<Writer>> m_writers;
 
     public:
@@ -42,33 +118,61 @@ namespace progdn
             return is_instance_created();
         }
 
+        static bool is_enabled(Level level) noexcept {
+            return (level <= m_threshold.load(std::memory_order_relaxed) && is_instance_created());
+        }
+
+        static void set_level(Level level) noexcept {
+            m_threshold.store(level, std::memory_order_relaxed);
+        }
+
+        // Level by name: "error", "warning", "info" or "debug"
+        static Level parse_level(const std::string& name);
+
+        template<typename... Arguments>
+        static void write(Level level, const Arguments&... arguments) noexcept {
+            if (!is_enabled(level))
+                return;
+            try {
+                Record record;
+                record.append_all(arguments...);
+                try_write(level, record.text());
+            } catch (...) {}
+        }
+
     public:
         template<typename WriterT, typename... Arguments>
-        void emplace_writer(Arguments... arguments) {
-            m_writers.emplace_back(new WriterT(std::forward<Arguments>(arguments)...));
+        WriterT& emplace_writer(Arguments... arguments) {
+            auto writer = new WriterT(std::forward<Arguments>(arguments)...);
+            m_writers.emplace_back(writer);
+            return *writer;
         }
 
         template<typename T>
         static void debug(const boost::basic_format<T>& messageText) noexcept {
-            try { debug(messageText.str()); } catch(...) {}
+            if (is_enabled(Debug))
+                try { debug(messageText.str()); } catch(...) {}
         }
 
         template<typename T>
         static void info(const boost::basic_format<T>& messageText) noexcept {
-            try { info(messageText.str()); } catch(...) {}
+            if (is_enabled(Info))
+                try { info(messageText.str()); } catch(...) {}
         }
 
         template<typename T>
         static void warning(const boost::basic_format<T>& messageText) noexcept {
-            try { warning(messageText.str()); } catch(...) {}
+            if (is_enabled(Warning))
+                try { warning(messageText.str()); } catch(...) {}
         }
 
         template<typename T>
         static void error(const boost::basic_format<T>& messageText) noexcept {
-            try { error(messageText.str()); } catch(...) {}
+            if (is_enabled(Error))
+                try { error(messageText.str()); } catch(...) {}
         }
 
     private:
-        static void try_write(Level level, const std::string& text) noexcept;
+        static void try_write(Level level, boost::string_view text) noexcept;
     };
 }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace progdn
+{
+    // Owner of an anonymous non-blocking pipe (for example, intermediate kernel buffer for splice)
+    class Pipe : public boost::noncopyable
+    {
+    private:
+        int m_fds[2] = { -1, -1 };
+
+    public:
+        Pipe() = default;
+
+        ~Pipe() {
+            close();
+        }
+
+    public:
+        // Returns errno on failure (and 0 on success)
+        int open() noexcept {
+            close();
+            if (::pipe2(m_fds, O_NONBLOCK | O_CLOEXEC) != 0)
+                return errno;
+            return 0;
+        }
+
+        void close() noexcept {
+            for (auto& fd : m_fds) {
+                if (fd >= 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+        }
+
+        bool is_open() const noexcept {
+            return (m_fds[0] >= 0);
+        }
+
+        int read_end() const noexcept {
+            return m_fds[0];
+        }
+
+        int write_end() const noexcept {
+            return m_fds[1];
+        }
+    };
+}
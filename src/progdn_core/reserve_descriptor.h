@@ -0,0 +1,61 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace progdn
+{
+    // Descriptor kept in reserve for the case, when the limit of open files is reached. It is released in order to
+    // accept a pending connection and reset it at once: otherwise the connection stays in the queue, and the listening
+    // socket remains readable, so the event loop spins.
+    class ReserveDescriptor : public boost::noncopyable
+    {
+    private:
+        int m_fd = -1;
+
+    public:
+        ReserveDescriptor() = default;
+
+        ~ReserveDescriptor() {
+            close();
+        }
+
+    public:
+        // Returns errno on failure (and 0 on success)
+        int open() noexcept {
+            close();
+            m_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            return (m_fd < 0 ? errno : 0);
+        }
+
+        void close() noexcept {
+            if (m_fd >= 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+        }
+
+        bool is_open() const noexcept {
+            return (m_fd >= 0);
+        }
+
+        // Accepts a connection using the reserved descriptor and resets it (client gets RST instead of waiting).
+        // Returns false, when there was no connection to accept.
+        bool shed_connection(int listening_fd) noexcept {
+            close();
+            auto fd = ::accept4(listening_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                linger no_linger = { 1, 0 };
+                ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &no_linger, sizeof(no_linger));
+                ::close(fd);
+            }
+            open();
+            return (fd >= 0);
+        }
+    };
+}
@@ -0,0 +1,278 @@
+#include <progdn_core/sockmap.h>
+
+#include <linux/bpf.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+namespace progdn
+{
+    namespace
+    {
+        long bpf(int command, union bpf_attr& attr) noexcept
+        {
+            return ::syscall(__NR_bpf, command, &attr, sizeof(attr));
+        }
+
+        int create_map(uint32_t type, uint32_t key_size, uint32_t value_size, uint32_t max_entries)
+        {
+            union bpf_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.map_type = type;
+            attr.key_size = key_size;
+            attr.value_size = value_size;
+            attr.max_entries = max_entries;
+            auto fd = bpf(BPF_MAP_CREATE, attr);
+            if (fd < 0)
+                throw std::system_error(errno, std::system_category(), "Cannot create BPF map");
+            return static_cast<int>(fd);
+        }
+
+        int update_element(int map_fd, const void* key, const void* value, uint64_t flags) noexcept
+        {
+            union bpf_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.map_fd = map_fd;
+            attr.key = reinterpret_cast<uint64_t>(key);
+            attr.value = reinterpret_cast<uint64_t>(value);
+            attr.flags = flags;
+            return (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) ? errno : 0;
+        }
+
+        void delete_element(int map_fd, const void* key) noexcept
+        {
+            union bpf_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.map_fd = map_fd;
+            attr.key = reinterpret_cast<uint64_t>(key);
+            bpf(BPF_MAP_DELETE_ELEM, attr);
+        }
+
+        int load_program(const bpf_insn* instructions, size_t instructions_number)
+        {
+            static const char kLicense[] = "Dual BSD/GPL";
+            char log[4096] = "";
+            union bpf_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+            attr.insns = reinterpret_cast<uint64_t>(instructions);
+            attr.insn_cnt = static_cast<uint32_t>(instructions_number);
+            attr.license = reinterpret_cast<uint64_t>(kLicense);
+            attr.log_buf = reinterpret_cast<uint64_t>(log);
+            attr.log_size = sizeof(log);
+            attr.log_level = 1;
+            auto fd = bpf(BPF_PROG_LOAD, attr);
+            if (fd < 0) {
+                auto error = errno;
+                throw std::system_error(error, std::system_category(),
+                                        std::string("Cannot load BPF program (") + log + ")");
+            }
+            return static_cast<int>(fd);
+        }
+
+        int attach_program(int program_fd, int map_fd, bpf_attach_type type) noexcept
+        {
+            union bpf_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.target_fd = static_cast<uint32_t>(map_fd);
+            attr.attach_bpf_fd = static_cast<uint32_t>(program_fd);
+            attr.attach_type = type;
+            return (bpf(BPF_PROG_ATTACH, attr) < 0) ? errno : 0;
+        }
+
+        int get_cookie(int fd, uint64_t& cookie) noexcept
+        {
+            socklen_t size = sizeof(cookie);
+            return (::getsockopt(fd, SOL_SOCKET, SO_COOKIE, &cookie, &size) < 0) ? errno : 0;
+        }
+
+        // Instructions (macros of the kernel tree are not exported to user space)
+        constexpr bpf_insn make_instruction(uint8_t code, uint8_t dst, uint8_t src, int16_t offset, int32_t immediate)
+        {
+            return bpf_insn{ code, dst, src, offset, immediate };
+        }
+
+        constexpr bpf_insn move_register(uint8_t dst, uint8_t src) {
+            return make_instruction(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+        }
+
+        constexpr bpf_insn move_immediate(uint8_t dst, int32_t immediate) {
+            return make_instruction(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, immediate);
+        }
+
+        constexpr bpf_insn add(uint8_t dst, int32_t immediate) {
+            return make_instruction(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, immediate);
+        }
+
+        constexpr bpf_insn call(int32_t function) {
+            return make_instruction(BPF_JMP | BPF_CALL, 0, 0, 0, function);
+        }
+
+        constexpr bpf_insn return_r0() {
+            return make_instruction(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+        }
+    }
+
+    Sockmap::Sockmap(size_t capacity)
+    {
+        auto entries = static_cast<uint32_t>(capacity * 2);
+        try {
+            m_targets_fd = create_map(BPF_MAP_TYPE_SOCKHASH, sizeof(uint64_t), sizeof(uint32_t), entries);
+            m_sources_fd = create_map(BPF_MAP_TYPE_SOCKHASH, sizeof(uint64_t), sizeof(uint32_t), entries);
+            m_counters_fd = create_map(BPF_MAP_TYPE_HASH, sizeof(uint64_t), sizeof(uint64_t), entries);
+            load_programs();
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    Sockmap::~Sockmap()
+    {
+        close();
+    }
+
+    void Sockmap::close() noexcept
+    {
+        for (auto fd : { m_parser_fd, m_verdict_fd, m_counters_fd, m_sources_fd, m_targets_fd }) {
+            if (fd >= 0)
+                ::close(fd);
+        }
+        m_parser_fd = m_verdict_fd = m_counters_fd = m_sources_fd = m_targets_fd = -1;
+    }
+
+    void Sockmap::load_programs()
+    {
+        // Key of both maps is cookie of the socket, which received data, and it is kept on the stack
+        const bpf_insn verdict[] = {
+            move_register(BPF_REG_6, BPF_REG_1),
+            call(BPF_FUNC_get_socket_cookie),
+            make_instruction(BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_0, -8, 0),
+            // counter = bpf_map_lookup_elem(&counters, &cookie)
+            make_instruction(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, m_counters_fd),
+            make_instruction(0, 0, 0, 0, 0),
+            move_register(BPF_REG_2, BPF_REG_10),
+            add(BPF_REG_2, -8),
+            call(BPF_FUNC_map_lookup_elem),
+            // if (counter) __sync_fetch_and_add(counter, skb->len)
+            make_instruction(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 2, 0),
+            make_instruction(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_6, offsetof(__sk_buff, len), 0),
+            make_instruction(BPF_STX | BPF_ATOMIC | BPF_DW, BPF_REG_0, BPF_REG_1, 0, BPF_ADD),
+            // return bpf_sk_redirect_hash(skb, &targets, &cookie, 0) (to send queue of the other socket)
+            move_register(BPF_REG_1, BPF_REG_6),
+            make_instruction(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_2, BPF_PSEUDO_MAP_FD, 0, m_targets_fd),
+            make_instruction(0, 0, 0, 0, 0),
+            move_register(BPF_REG_3, BPF_REG_10),
+            add(BPF_REG_3, -8),
+            move_immediate(BPF_REG_4, 0),
+            call(BPF_FUNC_sk_redirect_hash),
+            return_r0(),
+        };
+        m_verdict_fd = load_program(verdict, sizeof(verdict) / sizeof(verdict[0]));
+        // Verdict without stream parser is supported since Linux 5.13; before, parser passes each skb as is
+        if (attach_program(m_verdict_fd, m_sources_fd, BPF_SK_SKB_VERDICT) == 0)
+            return;
+        const bpf_insn parser[] = {
+            make_instruction(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_0, BPF_REG_1, offsetof(__sk_buff, len), 0),
+            return_r0(),
+        };
+        m_parser_fd = load_program(parser, sizeof(parser) / sizeof(parser[0]));
+        if (auto error = attach_program(m_parser_fd, m_sources_fd, BPF_SK_SKB_STREAM_PARSER))
+            throw std::system_error(error, std::system_category(), "Cannot attach BPF stream parser");
+        if (auto error = attach_program(m_verdict_fd, m_sources_fd, BPF_SK_SKB_STREAM_VERDICT))
+            throw std::system_error(error, std::system_category(), "Cannot attach BPF verdict");
+    }
+
+    int Sockmap::insert(int first_fd, int second_fd, Pair& pair) noexcept
+    {
+        pair.remove();
+        uint64_t cookies[2];
+        if (auto error = get_cookie(first_fd, cookies[0]))
+            return error;
+        if (auto error = get_cookie(second_fd, cookies[1]))
+            return error;
+
+        const uint64_t zero = 0;
+        const uint32_t fds[2] = { static_cast<uint32_t>(first_fd), static_cast<uint32_t>(second_fd) };
+        int error = 0;
+        for (size_t i = 0; i < 2 && !error; ++i)
+            error = update_element(m_counters_fd, &cookies[i], &zero, BPF_ANY);
+        // Socket is the target of data received by the other one
+        for (size_t i = 0; i < 2 && !error; ++i)
+            error = update_element(m_targets_fd, &cookies[i], &fds[1 - i], BPF_NOEXIST);
+        for (size_t i = 0; i < 2 && !error; ++i)
+            error = update_element(m_sources_fd, &cookies[i], &fds[i], BPF_NOEXIST);
+        if (error) {
+            remove(cookies);
+            return error;
+        }
+
+        // Data received before insertion is passed to the program, when a socket is woken up
+        // (SO_RCVLOWAT checks readiness of the socket)
+        int low_watermark = 1;
+        for (auto fd : fds)
+            ::setsockopt(static_cast<int>(fd), SOL_SOCKET, SO_RCVLOWAT, &low_watermark, sizeof(low_watermark));
+
+        pair.m_owner = shared_from_this();
+        pair.m_cookies[0] = cookies[0];
+        pair.m_cookies[1] = cookies[1];
+        return 0;
+    }
+
+    int Sockmap::get_written_bytes(int fd, uint64_t& bytes) noexcept
+    {
+        // Acknowledged bytes and bytes in the send queue (the latter is read after, so a concurrent
+        // acknowledgement may only make the sum smaller)
+        tcp_info info;
+        std::memset(&info, 0, sizeof(info));
+        socklen_t size = sizeof(info);
+        if (::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &size) < 0)
+            return errno;
+        int queued = 0;
+        if (::ioctl(fd, SIOCOUTQ, &queued) < 0)
+            return errno;
+        bytes = info.tcpi_bytes_acked + static_cast<uint64_t>(queued);
+        return 0;
+    }
+
+    void Sockmap::remove(const uint64_t (&cookies)[2]) noexcept
+    {
+        // Sources are removed first, so the program does not run for a socket without target
+        for (auto map_fd : { m_sources_fd, m_targets_fd, m_counters_fd }) {
+            for (auto cookie : cookies)
+                delete_element(map_fd, &cookie);
+        }
+    }
+
+    uint64_t Sockmap::Pair::redirected_bytes(size_t index) const noexcept
+    {
+        if (!m_owner)
+            return 0;
+        uint64_t bytes = 0;
+        union bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.map_fd = m_owner->m_counters_fd;
+        attr.key = reinterpret_cast<uint64_t>(&m_cookies[index]);
+        attr.value = reinterpret_cast<uint64_t>(&bytes);
+        bpf(BPF_MAP_LOOKUP_ELEM, attr);
+        return bytes;
+    }
+
+    void Sockmap::Pair::remove() noexcept
+    {
+        if (m_owner) {
+            m_owner->remove(m_cookies);
+            m_owner.reset();
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace progdn
+{
+    // Relay of payload between pairs of TCP sockets by the kernel (BPF sockmap; bpf(2) is called directly, libbpf is
+    // not required). Program SK_SKB verdict redirects data received by a socket to the send queue of its pair, so
+    // payload never reaches user space. The program also counts redirected bytes of each socket: relay in a
+    // direction is complete, when the destination socket has written all of them.
+    //
+    // Sockets are placed into two maps: "targets" (without programs) by cookie of the paired socket and "sources"
+    // (with the program) by own cookie. Pair is inserted into "targets" first, so the program always finds the other
+    // socket. Data received before insertion is processed by the program too (sockets are woken up by SO_RCVLOWAT),
+    // so order of payload is kept, as long as user space does not read the sockets after insertion.
+    class Sockmap : public std::enable_shared_from_this<Sockmap>, public boost::noncopyable
+    {
+    public:
+        // Sockets inserted into the maps; they are removed on destruction (or by the kernel, when they are closed)
+        class Pair : public boost::noncopyable
+        {
+            friend class Sockmap;
+
+        private:
+            std::shared_ptr<Sockmap> m_owner;
+            uint64_t m_cookies[2] = {};
+
+        public:
+            Pair() = default;
+
+            ~Pair() {
+                remove();
+            }
+
+        public:
+            bool is_inserted() const noexcept {
+                return (m_owner != nullptr);
+            }
+
+            // Bytes received by socket "index" (0 - the first one) and redirected to the other one
+            uint64_t redirected_bytes(size_t index) const noexcept;
+
+            void remove() noexcept;
+        };
+
+    private:
+        int m_targets_fd = -1;
+        int m_sources_fd = -1;
+        int m_counters_fd = -1;
+        int m_verdict_fd = -1;
+        int m_parser_fd = -1;
+
+    public:
+        // "capacity" - maximal number of pairs. Throws std::system_error, when the kernel does not support
+        // (or does not permit) the programs.
+        explicit Sockmap(size_t capacity);
+        ~Sockmap();
+
+    public:
+        // Starts relay between connected sockets. Returns errno on failure (and 0 on success).
+        int insert(int first_fd, int second_fd, Pair& pair) noexcept;
+
+        // Bytes written to the socket so far (sent and queued). Returns errno on failure (and 0 on success).
+        static int get_written_bytes(int fd, uint64_t& bytes) noexcept;
+
+    private:
+        void load_programs();
+        void close() noexcept;
+        void remove(const uint64_t (&cookies)[2]) noexcept;
+    };
+}
@@ -16,10 +16,10 @@ namespace progdn
         ::closelog();
     }
 
-    void SystemLog::write(Level messageLevel, const std::string& messageText)
+    void SystemLog::write(Level messageLevel, boost::string_view messageText)
     {
         auto priority = to_priority(messageLevel);
-        ::syslog(priority, "%s", messageText.c_str());
+        ::syslog(priority, "%.*s", static_cast<int>(messageText.size()), messageText.data());
     }
 
     int SystemLog::to_priority(Level level) noexcept
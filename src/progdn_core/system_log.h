@@ -11,7 +11,7 @@ namespace progdn
         virtual ~SystemLog();
 
     private:
-        virtual void write(Level messageLevel, const std::string& messageText) override;
+        virtual void write(Level messageLevel, boost::string_view messageText) override;
         static int to_priority(Level level) noexcept;
     };
 }
@@ -0,0 +1,121 @@
+#include <progdn_core/timing_wheel.h>
+
+#include <algorithm>
+
+namespace progdn
+{
+    const uint64_t TimingWheel::kMaximalTicks;
+
+    void TimingWheel::Timer::cancel() noexcept
+    {
+        if (m_wheel) {
+            m_prev->m_next = m_next;
+            m_next->m_prev = m_prev;
+            m_prev = m_next = nullptr;
+            --m_wheel->m_armed_timers;
+            m_wheel = nullptr;
+        }
+    }
+
+    TimingWheel::TimingWheel(boost::asio::io_context& io_context, Duration tick) :
+        m_ticker(io_context),
+        m_tick(tick),
+        m_current_tick_time(std::chrono::steady_clock::now())
+    {
+    }
+
+    TimingWheel::~TimingWheel()
+    {
+        for (auto& level : m_levels) {
+            for (auto& slot : level) {
+                while (slot.sentinel.m_next != &slot.sentinel)
+                    slot.sentinel.m_next->cancel();
+            }
+        }
+    }
+
+    void TimingWheel::arm(Timer& timer, Duration timeout)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!m_is_ticking && m_armed_timers == 0) {
+            // Nothing to fire while wheel was idle, so it just jumps to the current time
+            m_current_tick_time = now;
+        }
+
+        timer.cancel();
+        // Rounded up and counted from the current tick (it may be behind actual time)
+        auto delay = (now - m_current_tick_time) + std::max(timeout, Duration(0));
+        auto ticks = static_cast<uint64_t>((delay + m_tick - std::chrono::nanoseconds(1)) / m_tick);
+        timer.m_expiry_tick = m_current_tick + std::min(std::max<uint64_t>(ticks, 1), kMaximalTicks);
+        timer.m_wheel = this;
+        ++m_armed_timers;
+        insert(timer);
+
+        if (!m_is_ticking)
+            schedule_tick();
+    }
+
+    void TimingWheel::insert(Timer& timer) noexcept
+    {
+        auto delta = (timer.m_expiry_tick > m_current_tick) ? (timer.m_expiry_tick - m_current_tick) : 0;
+        size_t level = 0;
+        while (level + 1 < kLevelsNumber && delta >= (uint64_t(1) << (kLevelBits * (level + 1))))
+            ++level;
+        auto index = (timer.m_expiry_tick >> (kLevelBits * level)) & (kSlotsPerLevel - 1);
+        auto& sentinel = m_levels[level][index].sentinel;
+        timer.m_prev = sentinel.m_prev;
+        timer.m_next = &sentinel;
+        sentinel.m_prev->m_next = &timer;
+        sentinel.m_prev = &timer;
+    }
+
+    void TimingWheel::advance() noexcept
+    {
+        ++m_current_tick;
+        m_current_tick_time += m_tick;
+
+        // When index of a level wraps, timers of the next level's current slot are moved to lower levels
+        size_t levels_to_cascade = 0;
+        while (levels_to_cascade + 1 < kLevelsNumber
+               && ((m_current_tick >> (kLevelBits * levels_to_cascade)) & (kSlotsPerLevel - 1)) == 0)
+            ++levels_to_cascade;
+        for (auto level = levels_to_cascade; level > 0; --level) {
+            auto index = (m_current_tick >> (kLevelBits * level)) & (kSlotsPerLevel - 1);
+            auto& sentinel = m_levels[level][index].sentinel;
+            auto timer = sentinel.m_next;
+            sentinel.m_prev = sentinel.m_next = &sentinel;
+            while (timer != &sentinel) {
+                auto next = timer->m_next;
+                insert(*timer);
+                timer = next;
+            }
+        }
+
+        // Timer is detached before its callback is called, so callback may re-arm or destroy it
+        auto& sentinel = m_levels[0][m_current_tick & (kSlotsPerLevel - 1)].sentinel;
+        while (sentinel.m_next != &sentinel) {
+            auto timer = sentinel.m_next;
+            timer->cancel();
+            try { timer->m_callback(); } catch (...) {}
+        }
+    }
+
+    void TimingWheel::on_tick(const boost::system::error_code& error)
+    {
+        m_is_ticking = false;
+        if (error == boost::asio::error::operation_aborted)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        while (m_armed_timers > 0 && m_current_tick_time + m_tick <= now)
+            advance();
+        if (m_armed_timers > 0 && !m_is_ticking)
+            schedule_tick();
+    }
+
+    void TimingWheel::schedule_tick()
+    {
+        m_is_ticking = true;
+        m_ticker.expires_at(m_current_tick_time + m_tick);
+        m_ticker.async_wait(std::bind(&TimingWheel::on_tick, this, std::placeholders::_1));
+    }
+}
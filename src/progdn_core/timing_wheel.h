@@ -0,0 +1,89 @@
+#pragma once
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace progdn
+{
+    // Hierarchical timing wheel with coarse ticks: arming and cancelling of a timer take O(1).
+    // Intended for numerous timeouts, which are rarely fired (for example, per connection), within a single thread
+    // of io_context. Wheel ticks only while there are armed timers, so it does not keep io_context running.
+    class TimingWheel : public boost::noncopyable
+    {
+    public:
+        using Duration = std::chrono::milliseconds;
+
+        // Timer is owned by user and is cancelled on destruction
+        class Timer : public boost::noncopyable
+        {
+            friend class TimingWheel;
+
+        private:
+            std::function<void()> m_callback;
+            TimingWheel* m_wheel = nullptr;
+            Timer* m_prev = nullptr;
+            Timer* m_next = nullptr;
+            uint64_t m_expiry_tick = 0;
+
+        public:
+            explicit Timer(std::function<void()> callback) : m_callback(std::move(callback)) {}
+            ~Timer() {
+                cancel();
+            }
+
+        public:
+            void cancel() noexcept;
+
+            bool is_armed() const noexcept {
+                return (m_wheel != nullptr);
+            }
+        };
+
+    private:
+        static const unsigned kLevelBits = 6;
+        static const size_t kSlotsPerLevel = 1 << kLevelBits;
+        static const size_t kLevelsNumber = 4;
+        static const uint64_t kMaximalTicks = (uint64_t(1) << (kLevelBits * kLevelsNumber)) - 1;
+
+        // Slot is a circular doubly-linked list with sentinel (which is never fired)
+        struct Slot {
+            Timer sentinel;
+            Slot() : sentinel(nullptr) {
+                sentinel.m_prev = sentinel.m_next = &sentinel;
+            }
+        };
+
+    private:
+        boost::asio::steady_timer m_ticker;
+        const Duration m_tick;
+        std::array<std::array<Slot, kSlotsPerLevel>, kLevelsNumber> m_levels;
+        uint64_t m_current_tick = 0;
+        std::chrono::steady_clock::time_point m_current_tick_time;
+        size_t m_armed_timers = 0;
+        bool m_is_ticking = false;
+
+    public:
+        explicit TimingWheel(boost::asio::io_context& io_context, Duration tick = Duration(100));
+        ~TimingWheel();
+
+    public:
+        // (Re)arms the timer to fire after "timeout" (rounded up to ticks)
+        void arm(Timer& timer, Duration timeout);
+
+        size_t armed_timers() const noexcept {
+            return m_armed_timers;
+        }
+
+    private:
+        void insert(Timer& timer) noexcept;
+        void on_tick(const boost::system::error_code& error);
+        void advance() noexcept;
+        void schedule_tick();
+    };
+}
@@ -0,0 +1,176 @@
+#include "routing_table.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace progdn
+{
+    namespace
+    {
+        // "<address>:<port>", where port may be "*" (returns 0) or range "<min>-<max>"
+        std::pair<std::string, std::string> split_port(const std::string& str)
+        {
+            auto colon = str.rfind(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == str.size())
+                throw std::runtime_error("port is not specified");
+            return std::make_pair(str.substr(0, colon), str.substr(colon + 1));
+        }
+
+        uint16_t parse_port(const std::string& str)
+        {
+            auto port = boost::lexical_cast<uint32_t>(str);
+            if (port == 0 || port > 65535)
+                throw std::runtime_error("port " + str + " is out of range");
+            return static_cast<uint16_t>(port);
+        }
+    }
+
+    RoutingTable::RoutingTable() :
+        RoutingTable(std::vector<Route>())
+    {
+    }
+
+    RoutingTable::RoutingTable(std::vector<Route> routes) :
+        m_routes(std::move(routes))
+    {
+        compile();
+    }
+
+    RoutingTable RoutingTable::parse(const boost::property_tree::ptree& section)
+    {
+        std::vector<Route> routes;
+        for (const auto& item : section) {
+            try {
+                routes.push_back(parse_route(item.first, item.second.get_value<std::string>()));
+            } catch (const std::exception& e) {
+                throw std::runtime_error("Invalid route '" + item.first + "': " + e.what());
+            }
+        }
+        return RoutingTable(std::move(routes));
+    }
+
+    boost::optional<boost::asio::ip::tcp::endpoint> RoutingTable::route(
+        const boost::asio::ip::address& address, uint16_t port) const noexcept
+    {
+        if (m_routes.empty())
+            return boost::none;
+        // The first interval starts with 0, so there is always an interval, which contains the key
+        auto address_interval = std::upper_bound(m_address_starts.begin(), m_address_starts.end(), to_key(address))
+            - m_address_starts.begin() - 1;
+        auto slice_begin = m_port_starts.begin() + m_port_slices[address_interval];
+        auto slice_end = m_port_starts.begin() + m_port_slices[address_interval + 1];
+        auto port_interval = std::upper_bound(slice_begin, slice_end, port) - m_port_starts.begin() - 1;
+        auto route_index = m_port_routes[port_interval];
+        if (route_index < 0)
+            return boost::none;
+        auto destination = m_routes[route_index].destination;
+        if (destination.port() == 0)
+            destination.port(port);
+        return destination;
+    }
+
+    RoutingTable::Key RoutingTable::to_key(const boost::asio::ip::address& address) noexcept
+    {
+        auto v6 = address.is_v4()
+            ? boost::asio::ip::address_v6::v4_mapped(address.to_v4())
+            : address.to_v6();
+        Key key = 0;
+        for (auto byte : v6.to_bytes())
+            key = (key << 8) | byte;
+        return key;
+    }
+
+    RoutingTable::Route RoutingTable::parse_route(const std::string& key, const std::string& value)
+    {
+        Route route;
+        auto network_ports = split_port(key);
+        auto slash = network_ports.first.find('/');
+        route.network = boost::asio::ip::make_address(network_ports.first.substr(0, slash));
+        auto maximal_prefix_length = route.network.is_v4() ? 32u : 128u;
+        route.prefix_length = (slash == std::string::npos)
+            ? maximal_prefix_length
+            : boost::lexical_cast<unsigned>(network_ports.first.substr(slash + 1));
+        if (route.prefix_length > maximal_prefix_length)
+            throw std::runtime_error("prefix length is out of range");
+
+        const auto& ports = network_ports.second;
+        if (ports == "*") {
+            route.port_min = 1;
+            route.port_max = 65535;
+        } else {
+            auto dash = ports.find('-');
+            route.port_min = parse_port(ports.substr(0, dash));
+            route.port_max = (dash == std::string::npos) ? route.port_min : parse_port(ports.substr(dash + 1));
+            if (route.port_min > route.port_max)
+                throw std::runtime_error("port range is empty");
+        }
+
+        auto destination = split_port(value);
+        route.destination.address(boost::asio::ip::make_address(destination.first));
+        route.destination.port(destination.second == "*" ? 0 : parse_port(destination.second));
+        return route;
+    }
+
+    void RoutingTable::compile()
+    {
+        struct Bounds {
+            Key address_min;
+            Key address_max;
+        };
+        std::vector<Bounds> bounds;
+        std::vector<Key> address_starts = { 0 };
+        for (const auto& route : m_routes) {
+            auto host_bits = (route.network.is_v4() ? 32u : 128u) - route.prefix_length;
+            auto host_mask = (host_bits == 128) ? ~Key(0) : ((Key(1) << host_bits) - 1);
+            auto address_min = to_key(route.network) & ~host_mask;
+            auto address_max = address_min | host_mask;
+            bounds.push_back({ address_min, address_max });
+            address_starts.push_back(address_min);
+            if (address_max != ~Key(0))
+                address_starts.push_back(address_max + 1);
+        }
+        std::sort(address_starts.begin(), address_starts.end());
+        address_starts.erase(std::unique(address_starts.begin(), address_starts.end()), address_starts.end());
+
+        // Port intervals of each address interval: the first route, which covers the interval, is applied
+        m_address_starts.clear();
+        m_port_slices.clear();
+        m_port_starts.clear();
+        m_port_routes.clear();
+        for (auto address_start : address_starts) {
+            std::vector<size_t> matching_routes;
+            std::vector<uint32_t> port_starts = { 0 };
+            for (size_t i = 0; i < m_routes.size(); ++i) {
+                if (bounds[i].address_min <= address_start && address_start <= bounds[i].address_max) {
+                    matching_routes.push_back(i);
+                    port_starts.push_back(m_routes[i].port_min);
+                    port_starts.push_back(m_routes[i].port_max + 1u);
+                }
+            }
+            std::sort(port_starts.begin(), port_starts.end());
+            port_starts.erase(std::unique(port_starts.begin(), port_starts.end()), port_starts.end());
+
+            m_address_starts.push_back(address_start);
+            m_port_slices.push_back(static_cast<uint32_t>(m_port_starts.size()));
+            for (auto port_start : port_starts) {
+                if (port_start > 65535)
+                    break;
+                int32_t route_index = -1;
+                for (auto i : matching_routes) {
+                    if (m_routes[i].port_min <= port_start && port_start <= m_routes[i].port_max) {
+                        route_index = static_cast<int32_t>(i);
+                        break;
+                    }
+                }
+                // Adjacent intervals with the same route are merged
+                if (m_port_starts.size() > m_port_slices.back() && m_port_routes.back() == route_index)
+                    continue;
+                m_port_starts.push_back(static_cast<uint16_t>(port_start));
+                m_port_routes.push_back(route_index);
+            }
+        }
+        m_port_slices.push_back(static_cast<uint32_t>(m_port_starts.size()));
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/optional.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace progdn
+{
+    // Routes from original destination of visitor (address from PROXY header) to destination server.
+    //
+    // Routes are compiled into flat sorted arrays: address space is split into intervals, within which the same
+    // routes apply, and each interval refers to a slice of port intervals with their destination servers. So lookup
+    // is two binary searches over contiguous arrays. Table is immutable: it is replaced as a whole on reload.
+    class RoutingTable
+    {
+    public:
+        struct Route {
+            // Network of original destination (IPv4 is matched as IPv4-mapped IPv6)
+            boost::asio::ip::address network;
+            unsigned prefix_length;
+            uint16_t port_min;
+            uint16_t port_max;
+            // Port 0 means original destination port
+            boost::asio::ip::tcp::endpoint destination;
+        };
+
+    private:
+        // Address as 128-bit number (IPv4 is mapped to IPv6)
+        using Key = unsigned __int128;
+
+    private:
+        std::vector<Route> m_routes;
+        // Starts of address intervals (the first one is 0) and beginnings of their slices of port intervals
+        // (one more element, which is the end of the last slice)
+        std::vector<Key> m_address_starts;
+        std::vector<uint32_t> m_port_slices;
+        // Starts of port intervals and indexes of their routes (-1 - no route)
+        std::vector<uint16_t> m_port_starts;
+        std::vector<int32_t> m_port_routes;
+
+    public:
+        // Empty table (nothing is routed)
+        RoutingTable();
+        // The first of matching routes is applied
+        explicit RoutingTable(std::vector<Route> routes);
+
+    public:
+        // Parses section of configuration, where each key is "<network>:<ports>" and each value is
+        // "<address>:<port>": "10.0.0.0/8:80 = 192.168.0.10:8080", "203.0.113.5:8000-8999 = 192.168.0.11:*"
+        // (port "*" means any port as a key and original port as a value).
+        static RoutingTable parse(const boost::property_tree::ptree& section);
+
+        // Destination server of a visitor (none, when there is no matching route)
+        boost::optional<boost::asio::ip::tcp::endpoint> route(
+            const boost::asio::ip::address& address, uint16_t port) const noexcept;
+
+        const std::vector<Route>& routes() const noexcept {
+            return m_routes;
+        }
+
+    private:
+        static Key to_key(const boost::asio::ip::address& address) noexcept;
+        static Route parse_route(const std::string& key, const std::string& value);
+        void compile();
+    };
+}
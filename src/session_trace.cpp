@@ -0,0 +1,126 @@
+#include "session_trace.h"
+
+#include <progdn_core/log.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace progdn
+{
+    const uint8_t TraceRecord::kVersion;
+    const uint8_t TraceRecord::kNotReaped;
+    const size_t SessionTrace::kDefaultCapacity;
+
+    namespace
+    {
+        int64_t to_nanoseconds(std::chrono::nanoseconds duration) noexcept
+        {
+            return duration.count();
+        }
+    }
+
+    SessionTrace::SessionTrace(const std::string& path, uint32_t sample_rate, size_t capacity) :
+        m_file(std::fopen(path.c_str(), "abe")),
+        m_sample_rate(std::max<uint32_t>(sample_rate, 1)),
+        m_clock_offset(to_nanoseconds(std::chrono::system_clock::now().time_since_epoch())
+                       - to_nanoseconds(SessionTimeline::Clock::now().time_since_epoch())),
+        m_records(capacity),
+        m_dropped_records(0),
+        m_is_stop_requested(false)
+    {
+        if (!m_file)
+            throw std::runtime_error("Cannot open trace file " + path + ": " + ::strerror(errno));
+    }
+
+    SessionTrace::~SessionTrace()
+    {
+        if (m_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_is_stop_requested = true;
+            }
+            m_condition.notify_one();
+            m_thread.join();
+        }
+        std::fclose(m_file);
+    }
+
+    void SessionTrace::start()
+    {
+        if (!m_thread.joinable())
+            m_thread = std::thread(&SessionTrace::run, this);
+    }
+
+    bool SessionTrace::is_sampled() const noexcept
+    {
+        // Counter per thread: identifiers of sessions are interleaved between threads
+        static thread_local uint32_t sessions = 0;
+        if (++sessions < m_sample_rate)
+            return false;
+        sessions = 0;
+        return true;
+    }
+
+    void SessionTrace::write(uint64_t session_id, const SessionTimeline& timeline, uint8_t reap_reason) noexcept
+    {
+        auto is_enqueued = m_records.try_enqueue([&](TraceRecord& record) {
+            const auto& accepted = timeline.times[SessionTimeline::Accepted];
+            record.session_id = session_id;
+            record.accepted = to_nanoseconds(accepted.time_since_epoch()) + m_clock_offset;
+            for (size_t i = SessionTimeline::HeaderReceived; i < SessionTimeline::kEventsNumber; ++i) {
+                auto event = static_cast<SessionTimeline::Event>(i);
+                record.offsets[i - 1] = timeline.is_marked(event)
+                    ? to_nanoseconds(timeline.times[i] - accepted)
+                    : -1;
+            }
+            record.reap_reason = reap_reason;
+            record.version = TraceRecord::kVersion;
+            std::memset(record.reserved, 0, sizeof(record.reserved));
+        });
+        if (!is_enqueued)
+            m_dropped_records.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void SessionTrace::run()
+    {
+        // Records are not urgent, so producers never wake up the thread: it polls the queue
+        static const std::chrono::milliseconds kPollingInterval(100);
+
+        bool is_write_failed = false;
+        auto write_record = [this, &is_write_failed](TraceRecord& record) {
+            if (std::fwrite(&record, sizeof(record), 1, m_file) != 1)
+                is_write_failed = true;
+        };
+        uint64_t reported_dropped_records = 0;
+        bool is_failure_reported = false;
+        while (true)
+        {
+            while (m_records.try_dequeue(write_record)) {}
+            if (std::fflush(m_file) != 0)
+                is_write_failed = true;
+            // Failure is reported once per series of failures
+            if (is_write_failed && !is_failure_reported)
+                Log::warning(std::string("Cannot write trace file: ") + ::strerror(errno));
+            is_failure_reported = is_write_failed;
+            is_write_failed = false;
+
+            auto dropped = dropped_records();
+            if (dropped != reported_dropped_records) {
+                Log::warning("Trace queue is full, dropped records: "
+                             + std::to_string(dropped - reported_dropped_records));
+                reported_dropped_records = dropped;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_is_stop_requested)
+                break;
+            m_condition.wait_for(lock, kPollingInterval);
+        }
+
+        // Rest of records are written on stop
+        while (m_records.try_dequeue(write_record)) {}
+        std::fflush(m_file);
+    }
+}
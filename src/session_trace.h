@@ -0,0 +1,122 @@
+#pragma once
+
+#include <progdn_core/bounded_mpsc_queue.h>
+#include <progdn_core/singleton.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace progdn
+{
+    // Times of events of a session by monotonic clock (zero - event did not happen)
+    struct SessionTimeline {
+        using Clock = std::chrono::steady_clock;
+
+        enum Event {
+            Accepted,
+            HeaderReceived,
+            Connected,
+            // The first payload from client / from destination server
+            FirstUpstreamByte,
+            FirstDownstreamByte,
+            Closed,
+            kEventsNumber
+        };
+
+        std::array<Clock::time_point, kEventsNumber> times = {};
+
+        void mark(Event event) noexcept {
+            times[event] = Clock::now();
+        }
+
+        bool is_marked(Event event) const noexcept {
+            return (times[event] != Clock::time_point());
+        }
+
+        Clock::duration elapsed(Event from, Event to) const noexcept {
+            return times[to] - times[from];
+        }
+    };
+
+    // Record of trace file: fixed size, native byte order, appended as is
+    struct TraceRecord {
+        static const uint8_t kVersion = 1;
+        static const uint8_t kNotReaped = 0xff;
+
+        uint64_t session_id;
+        // Time of accepting (nanoseconds since Unix epoch)
+        int64_t accepted;
+        // Nanoseconds from accepting to events HeaderReceived...Closed (-1 - event did not happen)
+        int64_t offsets[SessionTimeline::kEventsNumber - 1];
+        // Reason of forced closing (Session::ReapReason) or kNotReaped
+        uint8_t reap_reason;
+        uint8_t version;
+        uint8_t reserved[6];
+
+        int64_t offset(SessionTimeline::Event event) const noexcept {
+            return (event == SessionTimeline::Accepted) ? 0 : offsets[event - 1];
+        }
+    };
+    static_assert(sizeof(TraceRecord) == 64, "Records of trace file have fixed size");
+
+    // Names of reasons of forced closing in order of Session::ReapReason (shared by logs and trace tools)
+    inline constexpr const char* kReapReasons[] = {
+        "header timeout", "idle timeout", "client idle timeout", "server idle timeout",
+        "half-closed timeout", "lifetime timeout", "dead peer", "memory pressure"
+    };
+    inline constexpr size_t kReapReasonsNumber = std::size(kReapReasons);
+
+    // Writes timelines of sampled sessions (each N-th session of a thread) to a trace file. Records are passed
+    // to a dedicated thread through a bounded lock-free queue, so event loops never block on the file and never
+    // allocate; records are dropped (and counted), when the queue is full.
+    class SessionTrace : public Singleton<SessionTrace>, public boost::noncopyable
+    {
+    public:
+        static const size_t kDefaultCapacity = 4096;
+
+    private:
+        std::FILE* m_file;
+        const uint32_t m_sample_rate;
+        // Difference between Unix time and monotonic clock at opening (nanoseconds)
+        const int64_t m_clock_offset;
+        BoundedMpscQueue<TraceRecord> m_records;
+        std::atomic<uint64_t> m_dropped_records;
+
+        std::thread m_thread;
+        std::atomic<bool> m_is_stop_requested;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+
+    public:
+        // Appends records to file "path"; "sample_rate" - one of how many sessions is traced
+        SessionTrace(const std::string& path, uint32_t sample_rate, size_t capacity = kDefaultCapacity);
+        ~SessionTrace();
+
+    public:
+        // Starts the thread of writing (after daemon(), since threads do not survive fork)
+        void start();
+
+        // Whether the current session of the calling thread is traced
+        bool is_sampled() const noexcept;
+
+        void write(uint64_t session_id, const SessionTimeline& timeline, uint8_t reap_reason) noexcept;
+
+        uint64_t dropped_records() const noexcept {
+            return m_dropped_records.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void run();
+    };
+}
@@ -0,0 +1,143 @@
+#include "stats_server.h"
+#include "metrics.h"
+
+#include <progdn_core/log.h>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+
+#include <cstring>
+#include <memory>
+
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace progdn
+{
+    StatsServer::StatsServer(const std::shared_ptr<boost::asio::io_context>& io_context) :
+        m_io_context(io_context),
+        m_acceptor(*m_io_context)
+    {
+    }
+
+    void StatsServer::start(const Protocol::endpoint& listen)
+    {
+        if (listen.protocol().family() == AF_UNIX) {
+            m_unix_path = reinterpret_cast<const sockaddr_un*>(listen.data())->sun_path;
+            // Socket file may be left by previous instance
+            ::unlink(m_unix_path.c_str());
+            Log::info("Statistics: unix:" + m_unix_path);
+        } else {
+            boost::asio::ip::tcp::endpoint tcp_endpoint;
+            std::memcpy(tcp_endpoint.data(), listen.data(), std::min<size_t>(listen.size(), sizeof(sockaddr_storage)));
+            PROGDN_LOG_INFO("Statistics: ", tcp_endpoint);
+        }
+        m_acceptor.open(listen.protocol());
+        if (m_unix_path.empty()) {
+            m_acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+            // New instance binds the port, while previous one is still running (upgrade)
+            int reuse_port = 1;
+            ::setsockopt(m_acceptor.native_handle(), SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port));
+        }
+        m_acceptor.bind(listen);
+        m_acceptor.listen();
+        struct stat status;
+        if (!m_unix_path.empty() && ::stat(m_unix_path.c_str(), &status) == 0)
+            m_unix_inode = status.st_ino;
+        boost::asio::co_spawn(*m_io_context, accept(shared_from_this()), boost::asio::detached);
+    }
+
+    void StatsServer::shutdown() noexcept
+    {
+        m_is_shutdown_requested = true;
+        boost::system::error_code error;
+        m_acceptor.close(error);
+        struct stat status;
+        if (!m_unix_path.empty() && ::stat(m_unix_path.c_str(), &status) == 0 && status.st_ino == m_unix_inode)
+            ::unlink(m_unix_path.c_str());
+    }
+
+    Awaitable<> StatsServer::accept(std::shared_ptr<StatsServer> self)
+    {
+        // Pause after failure (for example, on the limit of open files) grows, while failures repeat
+        static const std::chrono::milliseconds kMinimalBackoff(10);
+        static const std::chrono::milliseconds kMaximalBackoff(1000);
+
+        boost::asio::steady_timer pause_timer(*self->m_io_context);
+        auto backoff = kMinimalBackoff;
+        while (!self->m_is_shutdown_requested)
+        {
+            Protocol::socket sock(*self->m_io_context);
+            boost::system::error_code error;
+            co_await self->m_acceptor.async_accept(sock, with_error(error));
+            if (error) {
+                if (error != boost::asio::error::operation_aborted) {
+                    PROGDN_LOG_ERROR("Cannot accept statistics client: ", error, ", retry in ", backoff.count(), " ms");
+                    pause_timer.expires_after(backoff);
+                    co_await pause_timer.async_wait(with_error(error));
+                    backoff = std::min(backoff * 2, kMaximalBackoff);
+                }
+                continue;
+            }
+            backoff = kMinimalBackoff;
+            // Clients are served concurrently, so a silent one does not delay scrapes until its timeout; extra ones
+            // are closed at once
+            if (self->m_clients_number >= kMaximalClients) {
+                PROGDN_LOG_WARNING("Too many statistics clients, connection is closed");
+                continue;
+            }
+            boost::asio::co_spawn(*self->m_io_context, serve(self, std::move(sock)), boost::asio::detached);
+        }
+    }
+
+    Awaitable<> StatsServer::serve(std::shared_ptr<StatsServer> self, Protocol::socket sock)
+    {
+        ++self->m_clients_number;
+        try {
+            co_await self->respond(sock);
+        } catch (const std::exception& e) {
+            PROGDN_LOG_ERROR("Cannot serve statistics client: ", e.what());
+        }
+        --self->m_clients_number;
+    }
+
+    Awaitable<> StatsServer::respond(Protocol::socket& sock)
+    {
+        static const std::chrono::seconds kTimeToReceiveRequest(5);
+        static const size_t kMaximalRequestSize = 8192;
+
+        // Handler of the timer may be already queued, when the read completes (cancel() does not stop it), so it
+        // touches the socket only while the read is in progress
+        auto is_read_finished = std::make_shared<bool>(false);
+        boost::asio::steady_timer timer(*m_io_context);
+        timer.expires_after(kTimeToReceiveRequest);
+        timer.async_wait([&sock, is_read_finished](const boost::system::error_code& error) {
+            if (!*is_read_finished && error != boost::asio::error::operation_aborted) {
+                boost::system::error_code cancel_error;
+                sock.cancel(cancel_error);
+            }
+        });
+
+        // Request itself is ignored: metrics are returned on any request
+        boost::asio::streambuf request(kMaximalRequestSize);
+        boost::system::error_code error;
+        co_await boost::asio::async_read_until(sock, request, "\r\n\r\n", with_error(error));
+        *is_read_finished = true;
+        timer.cancel();
+        if (error)
+            co_return;
+
+        auto body = metrics::to_prometheus_text();
+        auto response = "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        "Connection: close\r\n"
+                        "\r\n" + body;
+        co_await boost::asio::async_write(sock, boost::asio::buffer(response), with_error(error));
+        sock.shutdown(Protocol::socket::shutdown_both, error);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <progdn_core/awaitable.h>
+
+#include <boost/asio/basic_socket_acceptor.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <sys/types.h>
+
+namespace progdn
+{
+    // Local HTTP endpoint, which exports metrics in Prometheus text format (on any request).
+    // Listens on TCP or Unix domain socket.
+    class StatsServer : public std::enable_shared_from_this<StatsServer>
+    {
+    private:
+        using Protocol = boost::asio::generic::stream_protocol;
+
+        // Clients served at once
+        static const size_t kMaximalClients = 16;
+
+    private:
+        std::shared_ptr<boost::asio::io_context> m_io_context;
+        boost::asio::basic_socket_acceptor<Protocol> m_acceptor;
+        // Socket file, which is removed on shutdown (empty for TCP), unless it is replaced by a new instance
+        std::string m_unix_path;
+        ino_t m_unix_inode = 0;
+        bool m_is_shutdown_requested = false;
+        size_t m_clients_number = 0;
+
+    public:
+        explicit StatsServer(const std::shared_ptr<boost::asio::io_context>& io_context);
+
+    public:
+        void start(const Protocol::endpoint& listen);
+
+        // Must be called within the thread of io_context
+        void shutdown() noexcept;
+
+    private:
+        // Server is kept alive by the coroutine until acceptor is closed
+        static Awaitable<> accept(std::shared_ptr<StatsServer> self);
+        static Awaitable<> serve(std::shared_ptr<StatsServer> self, Protocol::socket sock);
+        Awaitable<> respond(Protocol::socket& sock);
+    };
+}
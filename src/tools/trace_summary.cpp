@@ -0,0 +1,156 @@
+// Summary of trace files of progdn-rvi (option "trace_file"): number of traced sessions, their time range,
+// latency percentiles of phases of sessions and numbers of sessions closed by server (by reason).
+//
+// Example:
+//   progdn-rvi-trace-summary /var/log/progdn-rvi/trace.bin
+//   progdn-rvi-trace-summary --dump trace.bin    (records as text, one per line)
+
+#include "session_trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using progdn::SessionTimeline;
+    using progdn::TraceRecord;
+    using progdn::kReapReasons;
+    using progdn::kReapReasonsNumber;
+
+    // Phase of session between two events
+    struct Phase {
+        const char* name;
+        SessionTimeline::Event from;
+        SessionTimeline::Event to;
+        // Milliseconds of sessions, which reached both events
+        std::vector<double> values;
+    };
+
+    double percentile(const std::vector<double>& sorted, double fraction) {
+        if (sorted.empty())
+            return 0;
+        auto index = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+        return sorted[std::min(std::max<size_t>(index, 1), sorted.size()) - 1];
+    }
+
+    std::string format_time(int64_t nanoseconds) {
+        auto seconds = static_cast<std::time_t>(nanoseconds / 1000000000);
+        std::tm tm;
+        ::gmtime_r(&seconds, &tm);
+        char text[64];
+        auto size = std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+        std::snprintf(text + size, sizeof(text) - size, ".%06" PRId64 " UTC", nanoseconds % 1000000000 / 1000);
+        return text;
+    }
+
+    void dump(const TraceRecord& record) {
+        std::printf("%" PRIu64 " %s", record.session_id, format_time(record.accepted).c_str());
+        for (auto offset : record.offsets) {
+            if (offset < 0)
+                std::printf(" -");
+            else
+                std::printf(" %.3f", static_cast<double>(offset) / 1e6);
+        }
+        if (record.reap_reason < kReapReasonsNumber)
+            std::printf(" (%s)", kReapReasons[record.reap_reason]);
+        std::printf("\n");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> paths;
+    bool is_dump = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--dump") == 0)
+            is_dump = true;
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        std::fprintf(stderr, "Usage: progdn-rvi-trace-summary [--dump] <trace file>...\n");
+        return 2;
+    }
+    if (is_dump)
+        std::printf("# session accepted header_received connected first_upstream_byte first_downstream_byte closed"
+                    " (ms since accepting)\n");
+
+    std::vector<Phase> phases = {
+        { "header wait", SessionTimeline::Accepted, SessionTimeline::HeaderReceived, {} },
+        { "connect", SessionTimeline::HeaderReceived, SessionTimeline::Connected, {} },
+        { "first request byte", SessionTimeline::Accepted, SessionTimeline::FirstUpstreamByte, {} },
+        { "first response byte", SessionTimeline::Connected, SessionTimeline::FirstDownstreamByte, {} },
+        { "duration", SessionTimeline::Accepted, SessionTimeline::Closed, {} },
+    };
+    size_t records_number = 0;
+    size_t invalid_records = 0;
+    std::vector<size_t> reaped(kReapReasonsNumber + 1, 0);
+    int64_t first_accepted = INT64_MAX;
+    int64_t last_accepted = INT64_MIN;
+
+    try {
+        for (const auto& path : paths) {
+            auto file = std::fopen(path.c_str(), "rb");
+            if (!file)
+                throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+            TraceRecord record;
+            while (std::fread(&record, sizeof(record), 1, file) == 1) {
+                if (record.version != TraceRecord::kVersion) {
+                    ++invalid_records;
+                    continue;
+                }
+                ++records_number;
+                if (is_dump)
+                    dump(record);
+                first_accepted = std::min(first_accepted, record.accepted);
+                last_accepted = std::max(last_accepted, record.accepted);
+                for (auto& phase : phases) {
+                    auto from = record.offset(phase.from);
+                    auto to = record.offset(phase.to);
+                    if (from >= 0 && to >= 0)
+                        phase.values.push_back(static_cast<double>(to - from) / 1e6);
+                }
+                if (record.reap_reason != TraceRecord::kNotReaped)
+                    ++reaped[std::min<size_t>(record.reap_reason, kReapReasonsNumber)];
+            }
+            std::fclose(file);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    if (is_dump)
+        return 0;
+
+    std::printf("Sessions: %zu", records_number);
+    if (invalid_records > 0)
+        std::printf(" (skipped records of unknown version: %zu)", invalid_records);
+    std::printf("\n");
+    if (records_number == 0)
+        return 0;
+    std::printf("Accepted: %s - %s\n\n", format_time(first_accepted).c_str(), format_time(last_accepted).c_str());
+
+    std::printf("%-20s %10s %10s %10s %10s %10s %10s\n", "ms", "sessions", "p50", "p90", "p99", "p99.9", "max");
+    for (auto& phase : phases) {
+        std::sort(phase.values.begin(), phase.values.end());
+        std::printf("%-20s %10zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", phase.name, phase.values.size(),
+                    percentile(phase.values, 0.5), percentile(phase.values, 0.9), percentile(phase.values, 0.99),
+                    percentile(phase.values, 0.999), phase.values.empty() ? 0.0 : phase.values.back());
+    }
+
+    if (std::any_of(reaped.begin(), reaped.end(), [](size_t number) { return number > 0; }))
+        std::printf("\nClosed by server:\n");
+    for (size_t i = 0; i <= kReapReasonsNumber; ++i) {
+        if (reaped[i] > 0)
+            std::printf("  %-20s %zu\n", i < kReapReasonsNumber ? kReapReasons[i] : "unknown", reaped[i]);
+    }
+    return 0;
+}
@@ -30,4 +30,10 @@ ip rule add fwmark ${MARK} lookup ${TABLE}
 ip route add local 0.0.0.0/0 dev lo table ${TABLE}
 echo 1 > ${DEFAULT_OUTBOUND_INTERFACE}/route_localnet 
 
+# The same for visitors with IPv6 addresses
+ip6tables -t mangle -I PREROUTING -m mark --mark ${MARK} -j CONNMARK --save-mark
+ip6tables -t mangle -I OUTPUT -m connmark --mark ${MARK} -j CONNMARK --restore-mark
+ip -6 rule add fwmark ${MARK} lookup ${TABLE}
+ip -6 route add local ::/0 dev lo table ${TABLE}
+
 echo "Done"